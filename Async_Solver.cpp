@@ -0,0 +1,108 @@
+//
+//  Async_Solver.cpp
+//  icp_project
+//
+//
+
+#include "Async_Solver.hpp"
+
+template <typename Scalar, int Layout>
+Basic_Async_Solver<Scalar, Layout>::Basic_Async_Solver(std::shared_ptr<Solver_Type> solver) :
+	icp_solver(solver) {}
+
+template <typename Scalar, int Layout>
+Basic_Async_Solver<Scalar, Layout>::~Basic_Async_Solver() {
+	cancel();
+	wait();
+}
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::start() {
+	if (worker.joinable()) {
+		return;
+	}
+	cancelled = false;
+	done = false;
+	worker = std::thread(&Basic_Async_Solver::run, this);
+}
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::pause() {
+	paused = true;
+}
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::resume() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		paused = false;
+	}
+	resumed.notify_all();
+}
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::cancel() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cancelled = true;
+	}
+	resumed.notify_all();
+}
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::wait() {
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+/*
+ * perform_icp(), one step() at a time, with a look at the controls and a
+ * pose posted in between.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_Async_Solver<Scalar, Layout>::run() {
+
+	Solver_Type &solver = *icp_solver;
+	solver.build_tree();
+	if (solver.global_initialization) {
+		solver.find_initial_pose();
+	}
+
+	Pose_Update update;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			resumed.wait(lock, [this] { return !paused || cancelled; });
+		}
+		if (cancelled || !solver.step()) {
+			break;
+		}
+
+		update.rotation = solver.final_rotation;
+		update.translation = solver.final_translation;
+		update.iteration = solver.get_iterations();
+		update.error = solver.get_error();
+		updates.post(update);
+
+		if (solver.verbose) {
+			std::cout << "Iteration: " << update.iteration << ", Error: " << update.error << std::endl;
+		}
+	}
+
+	update.rotation = solver.final_rotation;
+	update.translation = solver.final_translation;
+	update.iteration = solver.get_iterations();
+	update.error = solver.get_error();
+	update.finished = true;
+	update.converged = solver.iteration_has_converged;
+	update.cancelled = cancelled;
+	updates.post(update);
+	done = true;
+}
+
+#define INSTANTIATE_ASYNC_SOLVER(Scalar, Layout) \
+	template class Basic_Async_Solver<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_ASYNC_SOLVER)
@@ -0,0 +1,130 @@
+//
+//  Async_Solver.hpp
+//  icp_project
+//
+//
+
+#ifndef Async_Solver_hpp
+#define Async_Solver_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <Eigen/Core>
+
+#include "ICP_Solver.hpp"
+
+/*
+ * Single-slot mailbox between one producer and one consumer thread. The
+ * producer posts values as fast as it likes, and the consumer takes the
+ * latest one whenever it looks; values it did not get to in between are
+ * dropped. Neither side ever waits for the other: three slots rotate
+ * through one atomic exchange each (a triple buffer).
+ */
+
+template <class T>
+class Mailbox {
+public:
+	/* Producer side: replaces the value waiting, if any */
+	void post(const T &value) {
+		slots[back] = value;
+		back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+	}
+
+	/* Consumer side: false if nothing was posted since the last take */
+	bool take(T &value) {
+		if (!(middle.load(std::memory_order_acquire) & fresh_bit)) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+		value = slots[front];
+		return true;
+	}
+
+private:
+	static const int fresh_bit = 4;
+	static const int index_mask = 3;
+
+	T slots[3];
+	int back = 0;					// producer's slot
+	std::atomic<int> middle{1};		// slot in between, and whether it is new
+	int front = 2;					// consumer's slot
+};
+
+/*
+ * Where a running solver has got to: the pose of the data after
+ * 'iteration' iterations, and whether it has stopped.
+ */
+
+struct Pose_Update {
+	Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+	int iteration = 0;
+	double error = 0;
+	bool finished = false;
+	bool converged = false;
+	bool cancelled = false;
+};
+
+/*
+ * Runs an ICP solver on a thread of its own, so a user interface stays
+ * responsive during long registrations. After every iteration the pose
+ * is posted to a Mailbox, which the interface polls, e.g. once a frame.
+ *
+ * pause() and cancel() take effect between iterations. The solver must
+ * not be touched from outside while the run is in progress; once
+ * finished() it holds the result as usual.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Basic_Async_Solver {
+public:
+	typedef Basic_ICP_Solver<Scalar, Layout> Solver_Type;
+
+	explicit Basic_Async_Solver(std::shared_ptr<Solver_Type> solver);
+
+	/* Cancels the run and waits for it */
+	~Basic_Async_Solver();
+
+	Basic_Async_Solver(const Basic_Async_Solver &) = delete;
+	Basic_Async_Solver &operator=(const Basic_Async_Solver &) = delete;
+
+	/* Starts the registration, once; builds the model index first if need be */
+	void start();
+
+	void pause();
+	void resume();
+	void cancel();
+
+	bool is_paused() const { return paused; }
+	bool finished() const { return done; }
+
+	/* The latest pose posted, false if there is none since the last poll */
+	bool poll(Pose_Update &update) { return updates.take(update); }
+
+	/* Blocks until the run has stopped */
+	void wait();
+
+	const std::shared_ptr<Solver_Type> &solver() const { return icp_solver; }
+
+private:
+	void run();
+
+	std::shared_ptr<Solver_Type> icp_solver;
+	std::thread worker;
+	Mailbox<Pose_Update> updates;
+
+	std::mutex mutex;
+	std::condition_variable resumed;
+	std::atomic<bool> paused{false};
+	std::atomic<bool> cancelled{false};
+	std::atomic<bool> done{false};
+};
+
+typedef Basic_Async_Solver<double> Async_Solver;
+typedef Basic_Async_Solver<float> Async_Solver_f;
+
+#endif /* Async_Solver_hpp */
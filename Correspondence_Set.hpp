@@ -0,0 +1,66 @@
+//
+//  Correspondence_Set.hpp
+//  icp_project
+//
+//
+
+#ifndef Correspondence_Set_hpp
+#define Correspondence_Set_hpp
+
+#include <vector>
+
+/*
+ * Point-pairs between the data and model meshes, stored as parallel arrays.
+ * Entry k pairs data vertex data_index[k] with model vertex model_index[k].
+ * 'distance' is the Euclidean distance between the two points, not the
+ * squared one the kd-tree metric reports.
+ *
+ * The arrays are only ever shrunk through resize(), so their capacity
+ * survives between iterations and nothing is reallocated after the first.
+ */
+
+struct Correspondence_Set {
+	std::vector<int> data_index;
+	std::vector<int> model_index;
+	std::vector<double> distance;
+	std::vector<double> weight;
+
+	size_t size() const { return data_index.size(); }
+
+	bool empty() const { return data_index.empty(); }
+
+	void resize(size_t n) {
+		data_index.resize(n);
+		model_index.resize(n);
+		distance.resize(n);
+		weight.resize(n);
+	}
+
+	void clear() { resize(0); }
+
+	/*
+	 * Removes every pair k for which keep(k) is false, preserving the order
+	 * of the remaining ones. Returns the number of pairs removed.
+	 */
+
+	template <class Predicate>
+	size_t compact(Predicate keep) {
+		size_t n = size();
+		size_t kept = 0;
+
+		for (size_t k=0; k<n; k++) {
+			if (keep(k)) {
+				data_index[kept] = data_index[k];
+				model_index[kept] = model_index[k];
+				distance[kept] = distance[k];
+				weight[kept] = weight[k];
+				kept++;
+			}
+		}
+
+		resize(kept);
+		return n - kept;
+	}
+};
+
+#endif /* Correspondence_Set_hpp */
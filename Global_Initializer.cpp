@@ -0,0 +1,201 @@
+//
+//  Global_Initializer.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+
+#include "Global_Initializer.hpp"
+#include "ICP_Solver.hpp"
+#include "Job_Scheduler.hpp"
+#include "Voxel_Grid.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/* A copy of 'points' thinned out by a voxel grid to about 'target' points */
+template <class Matrix, typename Scalar, int Layout>
+static Matrix thinned(const Point_Cloud_Adaptor<Scalar, Layout> &points, size_t target) {
+
+	Matrix all;
+	resize_points(all, points.count);
+	for (size_t i=0; i<points.count; i++) {
+		for (int d=0; d<3; d++) all(i, d) = points.coeff(i, d);
+	}
+	if (points.count <= target || target == 0) {
+		return all;
+	}
+
+	// On a surface the count goes with the inverse square of the spacing
+	double voxel_size = estimate_point_spacing(all) * sqrt(double(points.count) / target);
+	return voxel_downsample(all, voxel_size);
+}
+
+/* Centroid, and the axes of largest to smallest spread as a rotation */
+template <typename Scalar, int Layout>
+static void principal_axes(const Point_Cloud_Adaptor<Scalar, Layout> &cloud,
+						   Eigen::Vector3d &centroid, Eigen::Matrix3d &axes) {
+
+	centroid.setZero();
+	for (size_t i=0; i<cloud.count; i++) {
+		centroid += cloud.point(i);
+	}
+	centroid /= std::max<size_t>(cloud.count, 1);
+
+	Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+	for (size_t i=0; i<cloud.count; i++) {
+		Eigen::Vector3d d = cloud.point(i) - centroid;
+		covariance += d * d.transpose();
+	}
+
+	// Eigenvalues come in increasing order
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(covariance);
+	axes.col(0) = eigen_solver.eigenvectors().col(2);
+	axes.col(1) = eigen_solver.eigenvectors().col(1);
+	axes.col(2) = axes.col(0).cross(axes.col(1));
+}
+
+/*
+ * Rotation i of n spread evenly over all orientations, from the super-
+ * Fibonacci spiral of Alexa, "Super-Fibonacci Spirals", CVPR 2022.
+ */
+static Eigen::Matrix3d spread_rotation(size_t i, size_t n) {
+
+	const double phi = sqrt(2.0);
+	const double psi = 1.533751168755204288118041;
+
+	double s = i + 0.5;
+	double r = sqrt(s / n), R = sqrt(1 - s / n);
+	double alpha = 2 * M_PI * s / phi, beta = 2 * M_PI * s / psi;
+	Eigen::Quaterniond q(r * sin(alpha), r * cos(alpha), R * sin(beta), R * cos(beta));
+	return q.normalized().toRotationMatrix();
+}
+
+template <typename Scalar, int Layout>
+Global_Init_Result find_global_pose(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+									const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+									const Global_Init_Options &options,
+									const Eigen::Matrix3d &initial_rotation,
+									const Eigen::Vector3d &initial_translation) {
+
+	typedef Basic_ICP_Solver<Scalar, Layout> Solver;
+	typedef typename Solver::Point_Matrix Point_Matrix;
+
+	Clock::time_point deadline = Clock::now() +
+	std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.time_budget));
+
+	Global_Init_Result result;
+	result.rotation = initial_rotation;
+	result.translation = initial_translation;
+	if (data_verts.count < 6 || model_verts.count < 6) {
+		return result;
+	}
+
+	// The trials run on thinned out clouds and share one model index
+	Point_Matrix data = thinned<Point_Matrix>(data_verts, options.trial_points);
+	Basic_Model_Index<Scalar, Layout> model_index(thinned<Point_Matrix>(model_verts, options.trial_points));
+
+	Eigen::Vector3d data_centroid, model_centroid;
+	Eigen::Matrix3d data_axes, model_axes;
+	principal_axes(Point_Cloud_Adaptor<Scalar, Layout>(data), data_centroid, data_axes);
+	principal_axes(model_index.verts(), model_centroid, model_axes);
+
+	// The pose handed in, the principal axes matched up with either sign,
+	// and the evenly spread rotations
+	std::vector<Eigen::Matrix3d> rotations;
+	for (int flip=0; flip<4; flip++) {
+		Eigen::Matrix3d axes = data_axes;
+		if (flip & 1) axes.col(0) *= -1;
+		if (flip & 2) axes.col(1) *= -1;
+		axes.col(2) = axes.col(0).cross(axes.col(1));
+		rotations.push_back(model_axes * axes.transpose());
+	}
+	for (size_t i=0; i<options.num_rotations; i++) {
+		rotations.push_back(spread_rotation(i, options.num_rotations));
+	}
+
+	struct Trial {
+		std::unique_ptr<Solver> solver;
+		double error = MAXFLOAT;
+		bool done = false;
+	};
+	std::vector<Trial> trials(rotations.size() + 1);
+	for (size_t c=0; c<trials.size(); c++) {
+		Trial &trial = trials[c];
+		trial.solver.reset(new Solver(data, model_index));
+		trial.solver->verbose = false;
+		trial.solver->num_threads = 1;
+		if (c == 0) {
+			trial.solver->final_rotation = initial_rotation;
+			trial.solver->final_translation = initial_translation;
+		} else {
+			trial.solver->final_rotation = rotations[c - 1];
+			trial.solver->final_translation = model_centroid - rotations[c - 1] * data_centroid;
+		}
+		trial.solver->build_tree();
+	}
+	result.candidates = trials.size();
+
+	std::vector<size_t> remaining(trials.size());
+	for (size_t c=0; c<trials.size(); c++) remaining[c] = c;
+
+	Job_Scheduler scheduler(options.num_workers);
+	for (;;) {
+		for (size_t k=0; k<remaining.size(); k++) {
+			Trial *trial = &trials[remaining[k]];
+			if (trial->done) continue;
+
+			scheduler.submit([trial, &options, deadline] {
+				for (size_t i=0; i<options.round_iterations && Clock::now() < deadline; i++) {
+					if (!trial->solver->step()) {
+						trial->done = true;
+						break;
+					}
+				}
+				trial->error = trial->solver->get_error();
+			});
+		}
+		scheduler.wait();
+		result.rounds++;
+
+		// Hopeless candidates drop out
+		std::stable_sort(remaining.begin(), remaining.end(), [&](size_t a, size_t b) {
+			return trials[a].error < trials[b].error;
+		});
+		size_t keep = std::max<size_t>(1, ceil(options.keep_fraction * remaining.size()));
+		remaining.resize(std::min(keep, remaining.size()));
+
+		bool all_done = true;
+		for (size_t k=0; k<remaining.size(); k++) all_done = all_done && trials[remaining[k]].done;
+
+		if (remaining.size() == 1 || all_done) {
+			break;
+		}
+		if (Clock::now() >= deadline) {
+			result.out_of_time = true;
+			break;
+		}
+	}
+
+	const Solver &best = *trials[remaining[0]].solver;
+	result.rotation = best.final_rotation;
+	result.translation = best.final_translation;
+	result.error = best.get_error();
+	return result;
+}
+
+#define INSTANTIATE_GLOBAL_INITIALIZER(Scalar, Layout) \
+	template Global_Init_Result find_global_pose(const Point_Cloud_Adaptor<Scalar, Layout> &, \
+												 const Point_Cloud_Adaptor<Scalar, Layout> &, \
+												 const Global_Init_Options &, \
+												 const Eigen::Matrix3d &, const Eigen::Vector3d &);
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_GLOBAL_INITIALIZER)
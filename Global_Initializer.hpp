@@ -0,0 +1,71 @@
+//
+//  Global_Initializer.hpp
+//  icp_project
+//
+//
+
+#ifndef Global_Initializer_hpp
+#define Global_Initializer_hpp
+
+#include <cstddef>
+
+#include <Eigen/Core>
+
+#include "Point_Storage.hpp"
+
+/*
+ * Settings of the global initialization (see find_global_pose).
+ */
+
+struct Global_Init_Options {
+	/* Rotations sampled evenly over all orientations, besides the principal axes ones */
+	size_t num_rotations = 64;
+
+	/* Both clouds are thinned out to about this many points for the trials */
+	size_t trial_points = 2000;
+
+	/* ICP iterations every remaining candidate runs per round */
+	size_t round_iterations = 5;
+
+	/* Fraction of the candidates, the lowest errors, going on to the next round */
+	double keep_fraction = 0.25;
+
+	/* Wall time the trials may take, in seconds */
+	double time_budget = 2;
+
+	/* Trials running at once, 0 means one per core */
+	size_t num_workers = 0;
+};
+
+struct Global_Init_Result {
+	/* Pose p -> rotation p + translation of the data */
+	Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+	double error = 0;			// RMS error of the best trial
+	size_t candidates = 0;
+	size_t rounds = 0;
+	bool out_of_time = false;	// the budget ran out before one candidate was left
+};
+
+/*
+ * Finds a starting pose for ICP when the data may be far from aligned.
+ * Candidate poses are the given one, the four that map the principal axes
+ * of the data onto those of the model, and evenly spread rotations about
+ * the data centroid, each moved onto the model centroid. Every candidate
+ * starts a short ICP on thinned out copies of the clouds, all searching
+ * one shared model index. After every round of iterations only the
+ * candidates with the lowest errors go on, until one is left or the time
+ * budget is used up; the best one so far is returned, to be refined on
+ * the full clouds.
+ *
+ * Instantiated for every Point_Storage.
+ */
+
+template <typename Scalar, int Layout>
+Global_Init_Result find_global_pose(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+									const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+									const Global_Init_Options &options,
+									const Eigen::Matrix3d &initial_rotation = Eigen::Matrix3d::Identity(),
+									const Eigen::Vector3d &initial_translation = Eigen::Vector3d::Zero());
+
+#endif /* Global_Initializer_hpp */
@@ -0,0 +1,46 @@
+//
+//  ICP_Config.hpp
+//  icp_project
+//
+//
+
+#ifndef ICP_Config_hpp
+#define ICP_Config_hpp
+
+#include <cstddef>
+
+/*
+ * Numeric settings of the iteration, see tools/icp_tune.cpp for a sweep
+ * over them. The defaults are the values the solvers were always run with.
+ */
+
+struct ICP_Config {
+	/* Iterations in all, over all resolution levels */
+	size_t max_iterations = 50;
+
+	/* Change of the error below which the iteration has converged */
+	double tolerance = 1e-6;
+
+	/* Fraction of the data points paired every iteration, drawn at random below 1 */
+	double sampling_quotient = 1;
+
+	/* sigma_rejection drops pairs this many standard deviations from the mean distance */
+	double rejection_sigma = 1.5;
+
+	/* Points per kd-tree leaf, for the model index the solver builds itself */
+	size_t max_leaf = 10;
+
+	/*
+	 * Largest bound on the last step, as a multiple of the model point
+	 * spacing, for which the neighbour cache is used. Above it hardly any
+	 * pair passes the gap test and the second neighbour is searched for
+	 * nothing.
+	 */
+	double cache_motion_limit = 0.5;
+
+	/* Voxel hash grid cells against the point spacing, and the rings searched before the tree */
+	double grid_cell_factor = 2;
+	int grid_max_rings = 1;
+};
+
+#endif /* ICP_Config_hpp */
@@ -7,45 +7,222 @@
 //
 
 const int dim = 3;
-const int max_leaf = 10;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <numeric>
 
 #include "ICP_Solver.hpp"
+#include "Voxel_Grid.hpp"
+
+static uint64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Scalar, int Layout>
+Basic_ICP_Solver<Scalar, Layout>::Basic_ICP_Solver() { std::cout << "Initialize with input meshes"; exit(-1); }
+
+template <typename Scalar, int Layout>
+Basic_ICP_Solver<Scalar, Layout>::Basic_ICP_Solver(Point_Matrix d, Point_Matrix m, const Eigen::MatrixXi &f) :
+	data_verts(std::move(d)), model_source(std::move(m)), model_source_faces(f) {
+	N_data = data_verts.rows();
+}
+
+template <typename Scalar, int Layout>
+Basic_ICP_Solver<Scalar, Layout>::Basic_ICP_Solver(const Eigen::MatrixXd &d, const Eigen::MatrixXd &m,
+										   const Eigen::MatrixXi &f) :
+	Basic_ICP_Solver(to_points<Point_Matrix>(d), to_points<Point_Matrix>(m), f) {}
+
+template <typename Scalar, int Layout>
+Basic_ICP_Solver<Scalar, Layout>::Basic_ICP_Solver(Point_Matrix d, const Model_Index_Type &index) :
+	data_verts(std::move(d)), model_index(&index) {
+	N_data = data_verts.rows();
+}
+
+template <typename Scalar, int Layout>
+Basic_ICP_Solver<Scalar, Layout>::Basic_ICP_Solver(const Eigen::MatrixXd &d, const Model_Index_Type &index) :
+	Basic_ICP_Solver(to_points<Point_Matrix>(d), index) {}
+
+/*
+ * Builds the model index unless one was handed in, and the data side
+ * of the resolution pyramid to go with it.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::build_tree() {
+	
+	uint64_t start = now_ns();
+	
+	if (!model_index) {
+		owned_model_index = std::make_shared<Model_Index_Type>(std::move(model_source),
+															   model_source_faces,
+															   num_levels, base_voxel_size,
+															   config.max_leaf);
+		model_source = Point_Matrix();
+		model_source_faces = Eigen::MatrixXi();
+		model_index = owned_model_index.get();
+	}
+	
+	build_levels();
+	
+	timings.tree_build += now_ns() - start;
+}
+
+/*
+ * Downsamples the data with the voxel size of every coarse model level.
+ * Iteration starts on the coarsest level that still has something
+ * left to match.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::build_levels() {
+	
+	coarse_data.clear();
+	current_level = 0;
+	neighbor_cache.clear();
+	use_grid = true;
+	level_radius = -1;
+	coarse_rotation = stored_rotation;
+	coarse_translation = stored_translation;
+	
+	for (size_t l=1; l<model_index->num_levels(); l++) {
+		coarse_data.push_back(voxel_downsample(data_verts, model_index->voxel_size(l)));
+		
+		// Too coarse to say anything about the alignment
+		if (coarse_data.back().rows() >= 2*dim) {
+			current_level = l;
+		}
+	}
+}
 
-ICP_Solver::ICP_Solver() { std::cout << "Initialize with input meshes"; exit(-1); }
+template <typename Scalar, int Layout>
+typename Basic_ICP_Solver<Scalar, Layout>::Point_Matrix &Basic_ICP_Solver<Scalar, Layout>::level_data() {
+	return current_level == 0 ? data_verts : coarse_data[current_level-1];
+}
 
-ICP_Solver::ICP_Solver(Eigen::MatrixXd d, Eigen::MatrixXd m) :
-	data_verts(d), model_verts(m) {
-	N_data = d.rows();
+template <typename Scalar, int Layout>
+const typename Basic_ICP_Solver<Scalar, Layout>::Points &Basic_ICP_Solver<Scalar, Layout>::level_model() const {
+	return model_index->verts(current_level);
 }
 
-void ICP_Solver::build_tree() {
+template <typename Scalar, int Layout>
+const typename Basic_ICP_Solver<Scalar, Layout>::kd_tree_type &Basic_ICP_Solver<Scalar, Layout>::level_tree() const {
+	return model_index->tree(current_level);
+}
+
+template <typename Scalar, int Layout>
+const typename Basic_ICP_Solver<Scalar, Layout>::Grid_Type *Basic_ICP_Solver<Scalar, Layout>::level_grid() const {
+	return current_level < level_grids.size() ? level_grids[current_level].get() : nullptr;
+}
+
+/*
+ * Builds the voxel hash grid of the current model level, with cells of
+ * config.grid_cell_factor times the point spacing, if the grid backend
+ * needs one.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::build_level_grid() {
 	
-	model_kd_tree = new kd_tree_t(dim, model_verts, max_leaf);
+	if (search_backend != voxel_hash_grid || level_grid()) {
+		return;
+	}
+	
+	uint64_t start = now_ns();
+	level_grids.resize(model_index->num_levels());
+	double cell_size = level_spacing > 0 ? config.grid_cell_factor * level_spacing : 1;
+	level_grids[current_level] = std::make_shared<Grid_Type>(level_model(), cell_size,
+															 config.grid_max_rings);
+	timings.tree_build += now_ns() - start;
 }
 
-bool ICP_Solver::perform_icp() {
+template <typename Scalar, int Layout>
+bool Basic_ICP_Solver<Scalar, Layout>::perform_icp() {
 	
 	build_tree();
 	
+	if (global_initialization) {
+		find_initial_pose();
+	}
+	
 	while (step()) {
-		std::cout << "Iteration: " << iter_counter <<
-		", Error: " << error << std::endl;
+		if (verbose) {
+			std::cout << "Iteration: " << iter_counter << ", Error: " << error
+			<< ", Rejected: " << 100 * record.rejection_ratio << "%" << std::endl;
+		}
 	}
 	
 	if (iteration_has_converged) {
-		std::cout << "Iteration converged!" << std::endl;
+		if (verbose) std::cout << "Iteration converged!" << std::endl;
 		return true;
 	} else {
-		std::cout << "Iteration did not converge.." << std::endl;
+		if (verbose) std::cout << "Iteration did not converge.." << std::endl;
 		return false;
 	}
 }
 
-bool ICP_Solver::step() {
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::find_initial_pose() {
+	
+	uint64_t start = now_ns();
+	
+	// The trials run on the data as stored, the current pose is one of
+	// the candidates
+	const Eigen::Matrix3d R = final_rotation * stored_rotation.transpose();
+	const Eigen::Vector3d t = final_translation - R * stored_translation;
+	Global_Init_Result result = find_global_pose(Points(data_verts), model_index->verts(0),
+												 global_init, R, t);
+	
+	final_rotation = result.rotation * stored_rotation;
+	final_translation = result.rotation * stored_translation + result.translation;
+	level_radius = -1;
+	neighbor_cache.clear();
+	
+	timings.initialization += now_ns() - start;
+	
+	if (verbose) {
+		std::cout << "Initial pose: best of " << result.candidates << " candidates after "
+		<< result.rounds << " rounds, error " << result.error
+		<< (result.out_of_time ? " (out of time)" : "") << std::endl;
+	}
+}
+
+template <typename Scalar, int Layout>
+bool Basic_ICP_Solver<Scalar, Layout>::step() {
+	const size_t max_it = config.max_iterations;
+	const double tolerance = config.tolerance;
 	double error_diff = std::abs(error-old_error);
+	
+	// Once the error levels off on a coarse level, continue on the next
+	// finer one. Convergence is only ever declared on the full meshes.
+	if (current_level > 0 && error_diff <= level_plateau * error) {
+		current_level--;
+		estimated_scale = 0;
+		neighbor_cache.clear();
+		use_grid = true;
+		level_radius = -1;
+		error = MAXFLOAT;
+		old_error = 0;
+		error_diff = std::abs(error-old_error);
+	}
+	
+	// Likewise the approximate search turns exact before convergence
+	if (current_level == 0 && search_backend == approximate_kd_tree && !search_refined &&
+		(error_diff <= level_plateau * error || error_diff < tolerance)) {
+		search_refined = true;
+		error = MAXFLOAT;
+		old_error = 0;
+		error_diff = std::abs(error-old_error);
+	}
 
 	if ((iter_counter < max_it) && !(error_diff < tolerance)) {
 		
+		record.start_ns = now_ns();
+		record.level = current_level;
+		
 		// Generate the downsampled truncated 1-nn point correspondence map
 		compute_closest_points();
 
@@ -53,188 +230,600 @@ bool ICP_Solver::step() {
 		translation = Eigen::Vector3d::Zero();
 		rotation = Eigen::Matrix3d::Zero();
 		
+		uint64_t start = now_ns();
 		compute_registration(translation, rotation);
 		
-		// Transform the data mesh
-		data_verts = data_verts * rotation.transpose();
-		data_verts = data_verts + translation.transpose().replicate(N_data, 1);
-		
-		// Store accumulative transformations
-		final_rotation = rotation*final_rotation;
-		final_translation += translation;
+		// Move the data mesh
+		transform_data(rotation, translation);
+		record.registration_ns = now_ns() - start;
+		timings.registration += record.registration_ns;
 		
 		// Save the error
 		old_error = error;
+		start = now_ns();
 		error = compute_rms_error(translation, rotation);
+		record.error_ns = now_ns() - start;
+		timings.error += record.error_ns;
+		
+		record.iteration = iter_counter;
+		record.error = error;
+		record.error_delta = error - old_error;
+		if (instrumented()) {
+			if (trace) trace->push(record);
+			if (on_iteration) on_iteration(record);
+		}
 		
 		iter_counter++;
 		
 	} else if (error_diff < tolerance) {
 		iteration_has_converged = true;
 		return false;
-	} else if (iter_counter == max_it) {
+	} else if (iter_counter >= max_it) {
 		return false;
 	}
 	
 	return true;
 }
 
-void ICP_Solver::compute_closest_points() {
+/*
+ * Moves the data mesh by (rotation, translation). Only the pose changes,
+ * the vertices stay where they are stored.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::transform_data(const Eigen::Matrix3d &rotation,
+								const Eigen::Vector3d &translation) {
 	
-	point_correspondence.clear();
-	weights.clear();
+	// |R - I| is 2 sin(angle / 2)
+	double sin_half_angle = sqrt(std::max(0.0, (3 - rotation.trace()) / 4));
+	Eigen::Vector3d center_motion = (rotation - Eigen::Matrix3d::Identity()) * level_center + translation;
+	last_motion = 2 * sin_half_angle * level_radius + center_motion.norm();
+	level_center += center_motion;
 	
-	// Downsample
-	size_t N_sample = ceil(sampling_quotient * N_data);
-	std::vector<int> sample(N_sample);
-	
-	for (int i=0; i<N_sample; i++) {
-		if (sampling_quotient == 1.0) {
-			sample[i] = i;
-		} else {
-			sample[i] = rand() % N_data;
+	// Store accumulative transformations
+	final_rotation = rotation * final_rotation;
+	final_translation = rotation * final_translation + translation;
+}
+
+/*
+ * The motion from the pose the current level is stored in to the
+ * current pose of the data.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::update_level_pose() {
+	
+	const bool coarse = current_level > 0;
+	const Eigen::Matrix3d &R = coarse ? coarse_rotation : stored_rotation;
+	const Eigen::Vector3d &t = coarse ? coarse_translation : stored_translation;
+	
+	// p -> final (stored^-1 p)
+	level_rotation = final_rotation * R.transpose();
+	level_translation = final_translation - level_rotation * t;
+}
+
+template <typename Scalar, int Layout>
+const typename Basic_ICP_Solver<Scalar, Layout>::Point_Matrix &Basic_ICP_Solver<Scalar, Layout>::transformed_data() {
+	
+	if (stored_rotation != final_rotation || stored_translation != final_translation) {
+		const Eigen::Matrix3d R = final_rotation * stored_rotation.transpose();
+		const Eigen::Vector3d t = final_translation - R * stored_translation;
+		
+		// Only the coordinate columns, the padding stays zero
+		data_verts.leftCols(3) = data_verts.leftCols(3) * R.transpose().template cast<Scalar>();
+		data_verts.leftCols(3).rowwise() += t.transpose().template cast<Scalar>();
+		
+		stored_rotation = final_rotation;
+		stored_translation = final_translation;
+	}
+	return data_verts;
+}
+
+/*
+ * Centre of the level's data in its current pose, its radius, which a
+ * rigid motion does not change, and the spacing of its model points.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::measure_level() {
+	
+	const Points data(level_data());
+	Eigen::Vector3d center = Eigen::Vector3d::Zero();
+	for (size_t i=0; i<data.count; i++) {
+		center += data.point(i);
+	}
+	center /= std::max<size_t>(data.count, 1);
+	
+	level_radius = 0;
+	for (size_t i=0; i<data.count; i++) {
+		level_radius = std::max(level_radius, (data.point(i) - center).norm());
+	}
+	level_center = level_rotation * center + level_translation;
+	
+	const Points &model = level_model();
+	Eigen::Vector3d lo = Eigen::Vector3d::Constant(MAXFLOAT), hi = -lo;
+	for (size_t i=0; i<model.count; i++) {
+		lo = lo.cwiseMin(model.point(i));
+		hi = hi.cwiseMax(model.point(i));
+	}
+	level_spacing = model.count > 1 ? (hi - lo).norm() / sqrt((double) model.count) : 0;
+	last_motion = MAXFLOAT;
+}
+
+/*
+ * 1-nn result set that counts the tree nodes the search visits. nanoflann
+ * asks for the current worst distance once in every leaf it scans and once
+ * in every inner node before deciding whether to cross the split.
+ */
+
+template <typename Scalar>
+struct Counting_Result_Set : nanoflann::KNNResultSet<Scalar, int> {
+	mutable uint64_t visits = 0;
+	
+	Counting_Result_Set(int capacity) : nanoflann::KNNResultSet<Scalar, int>(capacity) {}
+	
+	Scalar worstDist() const {
+		visits++;
+		return nanoflann::KNNResultSet<Scalar, int>::worstDist();
+	}
+};
+
+template <typename Scalar>
+static inline Scalar sq(Scalar x) { return x * x; }
+
+template <class Result_Set>
+static uint64_t visits_of(const Result_Set &) { return 0; }
+
+template <typename Scalar>
+static uint64_t visits_of(const Counting_Result_Set<Scalar> &result_set) { return result_set.visits; }
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::Distance_Sums::add(const Distance_Sums &other) {
+	sum += other.sum;
+	sq_sum += other.sq_sum;
+	max = std::max(max, other.max);
+	zero_weights += other.zero_weights;
+	reused += other.reused;
+	in_grid_reach += other.in_grid_reach;
+}
+
+/*
+ * Runs the instance of search_neighbors for this iteration's neighbour
+ * cache use and kernel weighting.
+ */
+
+template <typename Scalar, int Layout>
+template <class Result_Set>
+uint64_t Basic_ICP_Solver<Scalar, Layout>::dispatch_search(size_t begin, size_t end,
+															  Distance_Sums &sums) {
+	
+	// sigma_rejection stands for no weights during the search
+	Robust_Kernel kernel = search_scale > 0 ? robust_kernel : sigma_rejection;
+	
+	if (use_neighbor_cache) {
+		switch (kernel) {
+			case huber_kernel: return search_neighbors<Result_Set, true, huber_kernel>(begin, end, sums);
+			case tukey_kernel: return search_neighbors<Result_Set, true, tukey_kernel>(begin, end, sums);
+			case cauchy_kernel: return search_neighbors<Result_Set, true, cauchy_kernel>(begin, end, sums);
+			case geman_mcclure_kernel: return search_neighbors<Result_Set, true, geman_mcclure_kernel>(begin, end, sums);
+			default: return search_neighbors<Result_Set, true, sigma_rejection>(begin, end, sums);
 		}
 	}
+	switch (kernel) {
+		case huber_kernel: return search_neighbors<Result_Set, false, huber_kernel>(begin, end, sums);
+		case tukey_kernel: return search_neighbors<Result_Set, false, tukey_kernel>(begin, end, sums);
+		case cauchy_kernel: return search_neighbors<Result_Set, false, cauchy_kernel>(begin, end, sums);
+		case geman_mcclure_kernel: return search_neighbors<Result_Set, false, geman_mcclure_kernel>(begin, end, sums);
+		default: return search_neighbors<Result_Set, false, sigma_rejection>(begin, end, sums);
+	}
+}
+
+/*
+ * Finds the closest model point for correspondences [begin, end), from
+ * the neighbour cache where it provably still holds if 'Cached', adds the
+ * distances to 'sums' and, unless 'Kernel' is sigma_rejection, sets the
+ * weights of that kernel. The data points are moved to their current pose
+ * as they are read. Safe to run concurrently on disjoint ranges. Returns
+ * the tree nodes visited if the result set counts them, and 0 otherwise.
+ */
+
+template <typename Scalar, int Layout>
+template <class Result_Set, bool Cached, Robust_Kernel Kernel>
+uint64_t Basic_ICP_Solver<Scalar, Layout>::search_neighbors(size_t begin, size_t end,
+															   Distance_Sums &sums) {
 	
-	// Do a 1-nn search
-	const size_t num_results = 1;
-	std::vector<size_t> nn_index(num_results);
-	std::vector<double> nn_distance(num_results);
-	std::vector<double> distances(N_data);
-	nanoflann::KNNResultSet<double> result_set(num_results);
-	double mean = 0;
+	const Points verts(level_data());
+	const kd_tree_type &tree = level_tree();
+	const Grid_Type *grid = use_grid ? level_grid() : nullptr;
+	const nanoflann::SearchParams params(10, level_epsilon);
 	
-	for (int j=0; j<N_sample; j++) {
+	const Eigen::Matrix<Scalar, 3, 3> R = level_rotation.template cast<Scalar>();
+	const Eigen::Matrix<Scalar, 3, 1> t = level_translation.template cast<Scalar>();
+	
+	const Scalar epsilon = std::numeric_limits<Scalar>::epsilon();
+	const double scale = search_scale;
+	
+	Result_Set result_set(Cached ? 2 : 1);
+	Scalar query_pt[dim];
+	double distance;
+	int nearest[2];
+	Scalar nearest_distance[2];
+	
+	for (size_t j=begin; j<end; j++) {
 		// find closest model-point for data-point 'i'
-		int i = sample[j];
+		int i = correspondences.data_index[j];
+		
+		const Scalar x = verts.coeff(i, 0), y = verts.coeff(i, 1), z = verts.coeff(i, 2);
+		for (int d=0; d<dim; d++) {
+			query_pt[d] = R(d, 0) * x + R(d, 1) * y + R(d, 2) * z + t(d);
+		}
 		
-		std::vector<double> query_pt = {data_verts(i, 0),
-										data_verts(i, 1),
-										data_verts(i, 2)};
+		bool reused = false;
+		if (Cached) {
+			const Cached_Neighbors &cached = neighbor_cache[i];
+			
+			// No model point gets nearer or further by more than the point
+			// moved, so the nearest one stays nearest while the gap to the
+			// second is over twice that. The margin covers the rounding of
+			// the distances.
+			Scalar moved = std::sqrt(sq(query_pt[0] - cached.query[0])
+									 + sq(query_pt[1] - cached.query[1])
+									 + sq(query_pt[2] - cached.query[2]));
+			Scalar margin = 16 * epsilon * (cached.second + moved);
+			
+			if (cached.index >= 0 && cached.second - cached.first > 2 * moved + margin) {
+				correspondences.model_index[j] = cached.index;
+				distance = std::sqrt(tree.distance(query_pt, cached.index, dim));
+				sums.reused++;
+				reused = true;
+			}
+		}
 		
-		result_set.init(&nn_index[0], &nn_distance[0]);
-		model_kd_tree->index->findNeighbors(result_set, &query_pt[0],
-										nanoflann::SearchParams(10));
+		if (!reused) {
+			// The grid answers for points near the model surface
+			result_set.init(nearest, nearest_distance);
+			if (!grid || !grid->find_neighbors(result_set, query_pt)) {
+				result_set.init(nearest, nearest_distance);
+				tree.findNeighbors(result_set, query_pt, params);
+			}
+			correspondences.model_index[j] = nearest[0];
+			distance = std::sqrt(nearest_distance[0]);
+			
+			if (Cached) {
+				Cached_Neighbors &cached = neighbor_cache[i];
+				std::copy(query_pt, query_pt + dim, cached.query);
+				cached.first = distance;
+				cached.second = std::sqrt(nearest_distance[1]);
+				cached.index = nearest[0];
+			}
+		}
 		
-		point_correspondence[i] = nn_index[0];
-		distances[i] = nn_distance[0];
-		mean += nn_distance[0];
+		const double d = distance;
+		correspondences.distance[j] = d;
+		sums.sum += d;
+		sums.sq_sum += d * d;
+		sums.max = std::max(sums.max, d);
+		sums.in_grid_reach += d < grid_reach;
 		
-	} mean /= N_sample;
+		if (Kernel != sigma_rejection) {
+			double w = kernel_weight<Kernel>(d, scale);
+			correspondences.weight[j] = w;
+			sums.zero_weights += w == 0;
+		}
+	}
+	
+	return visits_of(result_set);
+}
+
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::compute_closest_points() {
 	
-	// Compute variance and std dev. of the distances
-	double variance = 0;
-	for (int i=0; i<N_sample; i++) {
-		variance += ((distances[sample[i]] - mean)*(distances[sample[i]] - mean));
-	} variance /= N_sample;
+	if (!thread_pool) {
+		thread_pool = std::make_shared<Thread_Pool>(num_threads);
+	}
 	
-	double std_deviation = sqrt(variance);
-	double rejected = 0;
+	// Downsample
+	size_t N_level = level_data().rows();
+	bool full_sample = config.sampling_quotient >= 1;
+	size_t N_sample = full_sample ? N_level : ceil(config.sampling_quotient * N_level);
+	correspondences.resize(N_sample);
 	
-	// Reject point-pairs based on threshold distance rule
-	double cmp;
-	for (int i=0; i<N_sample; i++) {
-		cmp = 1.5*std_deviation;
-		if (std::abs(distances[sample[i]] - mean) > cmp) {
-			point_correspondence.erase(sample[i]);
-			rejected++;
+	std::vector<int> &sample = correspondences.data_index;
+	if (full_sample) {
+		std::iota(sample.begin(), sample.end(), 0);
+	} else {
+		for (size_t i=0; i<N_sample; i++) {
+			sample[i] = rand() % N_level;
 		}
 	}
 	
-	std::cout << "Rejected " << rejected / N_sample
-	<< "% of the sample point-pairs." << std::endl;
+	update_level_pose();
 	
-	// Find max distance between points
-	std::vector<double>::iterator max_dist_it;
-	max_dist_it = std::max_element(distances.begin(), distances.end());
-
-	// Define weights for registration step
-	for (std::map<int, int>::iterator it = point_correspondence.begin();
-		 it != point_correspondence.end(); ++it) {
+	if (level_radius < 0) {
+		measure_level();
+	}
+	build_level_grid();
+	grid_reach = level_grid() ? config.grid_max_rings * level_grid()->cell_size() : 0;
+	
+	bool approximate = search_backend == approximate_kd_tree && !search_refined;
+	level_epsilon = approximate ? search_epsilon : 0;
+	
+	// The cache is per data point, which only works while every point is
+	// searched exactly once, and by an exact search. It costs a 2-nn search
+	// to fill, so it is only used once the steps have become small against
+	// the point spacing.
+	use_neighbor_cache = incremental_search && full_sample && !approximate &&
+	last_motion < config.cache_motion_limit * level_spacing;
+	if (use_neighbor_cache && neighbor_cache.size() != N_level) {
+		neighbor_cache.assign(N_level, Cached_Neighbors());
+	}
+	
+	// The kernel weights can be set during the search unless the scale
+	// has to be estimated from this iteration's distances
+	search_scale = 0;
+	if (robust_kernel != sigma_rejection) {
+		search_scale = kernel_scale > 0 ? kernel_scale : estimated_scale;
+	}
+	
+	partial_sums.assign(thread_pool->size(), Distance_Sums());
+	
+	// Do a 1-nn search, split over the thread pool. Counting the visited
+	// tree nodes is left out of the search loop unless somebody looks.
+	uint64_t start = now_ns();
+	if (instrumented()) {
+		std::atomic<uint64_t> nodes_visited(0);
+		thread_pool->parallel_for(N_sample, [&](size_t begin, size_t end, size_t thread_id) {
+			Distance_Sums local;
+			nodes_visited += dispatch_search<Counting_Result_Set<Scalar> >(begin, end, local);
+			partial_sums[thread_id].add(local);
+		});
+		record.nodes_visited = nodes_visited;
+	} else {
+		thread_pool->parallel_for(N_sample, [this](size_t begin, size_t end, size_t thread_id) {
+			Distance_Sums local;
+			dispatch_search<nanoflann::KNNResultSet<Scalar, int> >(begin, end, local);
+			partial_sums[thread_id].add(local);
+		});
+	}
+	uint64_t searched = now_ns();
+	record.correspondence_ns = searched - start;
+	timings.correspondence += record.correspondence_ns;
+	
+	Distance_Sums sums;
+	for (size_t t=0; t<partial_sums.size(); t++) {
+		sums.add(partial_sums[t]);
+	}
+	
+	// Mean and standard deviation of the distances, from the sums
+	double mean = sums.sum / N_sample;
+	double variance = std::max(sums.sq_sum / N_sample - mean * mean, 0.0);
+	double std_deviation = sqrt(variance);
+	double rms = sqrt(sums.sq_sum / N_sample);
+	
+	// Trimmed ICP: the keep_count closest pairs stay. The threshold is
+	// selected in linear time, and pairs tied with it are kept up to the
+	// count.
+	Rejection_Bounds bounds;
+	bool trim = overlap_ratio < 1;
+	if (trim) {
+		size_t keep_count = std::max<size_t>(ceil(overlap_ratio * N_sample), 1);
+		keep_count = std::min(keep_count, N_sample);
 		
-		weights[it->first] = 1 - (distances[it->first] / *max_dist_it);
+		const std::vector<double> &distances = correspondences.distance;
+		trim_scratch.assign(distances.begin(), distances.end());
+		std::vector<double>::iterator nth = trim_scratch.begin() + (keep_count - 1);
+		std::nth_element(trim_scratch.begin(), nth, trim_scratch.end());
+		bounds.trim_distance = *nth;
 		
+		bounds.ties_left = 1;
+		for (std::vector<double>::iterator it = trim_scratch.begin(); it != nth; ++it) {
+			bounds.ties_left += *it == bounds.trim_distance;
+		}
 	}
+	
+	// Reject point-pairs based on threshold distance rule
+	bounds.mean = mean;
+	bounds.max_deviation = config.rejection_sigma * std_deviation;
+	bounds.weight_scale = search_scale > 0 ? search_scale : rms;
+	bounds.max_distance = trim ? bounds.trim_distance : sums.max;
+	bool set_weights = robust_kernel == sigma_rejection || search_scale <= 0;
+	
+	// Nothing to do if the search set all the weights and none is zero
+	size_t rejected = 0;
+	if (trim || set_weights || sums.zero_weights > 0) {
+		rejected = dispatch_rejection(bounds, trim, set_weights);
+	}
+	
+	if (robust_kernel != sigma_rejection && kernel_scale <= 0) {
+		estimated_scale = rms;
+	}
+	
+	use_grid = 2 * sums.in_grid_reach >= N_sample;
+	
+	record.sample_size = N_sample;
+	record.reused = sums.reused;
+	record.inliers = correspondences.size();
+	record.rejection_ratio = double(rejected) / N_sample;
+	
+	record.rejection_ns = now_ns() - searched;
+	timings.rejection += record.rejection_ns;
 }
 
-void ICP_Solver::compute_registration(Eigen::Vector3d &translation,
-						  Eigen::Matrix3d &rotation) {
+/*
+ * Runs the instance of reject_pairs for the kernel, trimming and whether
+ * the search left the weights to set. Returns the pairs dropped.
+ */
+
+template <typename Scalar, int Layout>
+size_t Basic_ICP_Solver<Scalar, Layout>::dispatch_rejection(Rejection_Bounds &bounds,
+															  bool trim, bool set_weights) {
+	
+	switch (robust_kernel) {
+		case huber_kernel:
+			if (trim) return set_weights ? reject_pairs<huber_kernel, true, true>(bounds)
+				: reject_pairs<huber_kernel, true, false>(bounds);
+			return set_weights ? reject_pairs<huber_kernel, false, true>(bounds)
+				: reject_pairs<huber_kernel, false, false>(bounds);
+		case tukey_kernel:
+			if (trim) return set_weights ? reject_pairs<tukey_kernel, true, true>(bounds)
+				: reject_pairs<tukey_kernel, true, false>(bounds);
+			return set_weights ? reject_pairs<tukey_kernel, false, true>(bounds)
+				: reject_pairs<tukey_kernel, false, false>(bounds);
+		case cauchy_kernel:
+			if (trim) return set_weights ? reject_pairs<cauchy_kernel, true, true>(bounds)
+				: reject_pairs<cauchy_kernel, true, false>(bounds);
+			return set_weights ? reject_pairs<cauchy_kernel, false, true>(bounds)
+				: reject_pairs<cauchy_kernel, false, false>(bounds);
+		case geman_mcclure_kernel:
+			if (trim) return set_weights ? reject_pairs<geman_mcclure_kernel, true, true>(bounds)
+				: reject_pairs<geman_mcclure_kernel, true, false>(bounds);
+			return set_weights ? reject_pairs<geman_mcclure_kernel, false, true>(bounds)
+				: reject_pairs<geman_mcclure_kernel, false, false>(bounds);
+		default:
+			// The sigma rule always sets its own weights
+			return trim ? reject_pairs<sigma_rejection, true, true>(bounds)
+				: reject_pairs<sigma_rejection, false, true>(bounds);
+	}
+}
+
+/*
+ * Drops the pairs beyond the trimming threshold if 'Trim', and otherwise
+ * those the sigma rule rejects, then weights the rest under 'Kernel' if
+ * 'Set_Weights'. Tukey gives no weight at all beyond its cut-off, such
+ * pairs are dropped as well.
+ */
+
+template <typename Scalar, int Layout>
+template <Robust_Kernel Kernel, bool Trim, bool Set_Weights>
+size_t Basic_ICP_Solver<Scalar, Layout>::reject_pairs(Rejection_Bounds &bounds) {
 	
-	size_t N_data = data_verts.rows();
-	size_t N_model = model_verts.rows();
-	size_t N_pc = point_correspondence.size();
+	const std::vector<double> &distances = correspondences.distance;
+	std::vector<double> &weights = correspondences.weight;
 	
-	// Centres-of-mass
-	Eigen::Vector3d data_COM = data_verts.colwise().sum() / N_data;
-	Eigen::Vector3d model_COM = model_verts.colwise().sum() / N_model;
+	const double mean = bounds.mean;
+	const double max_deviation = bounds.max_deviation;
+	const double max_distance = bounds.max_distance;
+	const double trim_distance = bounds.trim_distance;
+	const double weight_scale = bounds.weight_scale;
+	size_t &ties_left = bounds.ties_left;
+	
+	return correspondences.compact([&](size_t j) {
+		const double d = distances[j];
+		if (Trim) {
+			if (d > trim_distance || (d == trim_distance && ties_left == 0)) return false;
+			if (d == trim_distance) ties_left--;
+		} else if (Kernel == sigma_rejection && std::abs(d - mean) > max_deviation) {
+			return false;
+		}
+		
+		// Define weights for registration step
+		if (Kernel == sigma_rejection) {
+			weights[j] = max_distance > 0 ? 1 - (d / max_distance) : 1;
+			return true;
+		}
+		if (Set_Weights) {
+			weights[j] = kernel_weight<Kernel>(d, weight_scale);
+		}
+		return weights[j] > 0;
+	});
+}
+
+/*
+ * Accumulates the weighted statistics of the current correspondences in a
+ * single pass and solves for the rigid transform.
+ */
 
-	// Construct covariance matrix
-	Eigen::Matrix3d covariance_matrix = Eigen::Matrix3d::Zero();
-	for(std::map<int,int>::iterator it = point_correspondence.begin();
-		it != point_correspondence.end(); ++it) {
-		int index = it->first;
-		covariance_matrix += weights[index]*(data_verts.row(index).transpose()
-							  * model_verts.row(it->second));
+template <typename Scalar, int Layout>
+void Basic_ICP_Solver<Scalar, Layout>::compute_registration(Eigen::Vector3d &translation,
+						  Eigen::Matrix3d &rotation) {
 	
-	} covariance_matrix /= N_pc;
-	covariance_matrix -= (data_COM * model_COM.transpose());
+	plane_solved = false;
+	if (objective == point_to_plane &&
+		compute_plane_registration(translation, rotation)) {
+		return;
+	}
 	
-	// Construct Q-matrix
-	Eigen::Matrix3d A = covariance_matrix - covariance_matrix.transpose();
-	Eigen::Vector3d delta;
-	delta << A(1, 2), A(2, 0), A(0, 1);
+	size_t N_pc = correspondences.size();
 	
-	Eigen::Matrix4d Q;
-	double Q_trace = covariance_matrix.trace();
-	Q(0, 0) = Q_trace;
-	Q.block(1, 0, 3, 1) = delta;
-	Q.block(0, 1, 1, 3) = delta.transpose();
-	Q.block(1, 1, 3, 3) = covariance_matrix
-	+ covariance_matrix.transpose()
-	- Q_trace * Eigen::MatrixXd::Identity(3,3);
+	// The pairs are summed about the model centroid, and about the stored
+	// data point the current pose takes there
+	const Eigen::Vector3d &model_origin = model_index->centroid(current_level);
+	const Eigen::Vector3d data_origin = level_rotation.transpose() * (model_origin - level_translation);
 	
-	// Find optimal unit quaternion
-	Eigen::EigenSolver<Eigen::Matrix4d> eigen_solver(Q);
-	Eigen::MatrixXd::Index max_ev_index;
-	eigen_solver.eigenvalues().real().cwiseAbs().maxCoeff(&max_ev_index);
-	Eigen::Vector4d q_optimal = eigen_solver.eigenvectors().real().col(max_ev_index);
+	partial_statistics.assign(thread_pool->size(), Pair_Statistics(data_origin, model_origin));
 	
-	// Store the computed solution in 'rotation' and 'translation'
-	quaternion_to_matrix(q_optimal, rotation);
-	translation = model_COM - rotation * data_COM;
+	thread_pool->parallel_for(N_pc, [&](size_t begin, size_t end, size_t thread_id) {
+		Pair_Statistics local(data_origin, model_origin);
+		accumulate_pair_statistics(Points(level_data()), level_model(), correspondences,
+								   begin, end, local);
+		partial_statistics[thread_id].add(local);
+	});
 	
-}
-
-double ICP_Solver::compute_rms_error(Eigen::Vector3d translation,
-						 Eigen::Matrix3d rotation) {
+	pair_statistics = Pair_Statistics(data_origin, model_origin);
+	for (size_t t=0; t<partial_statistics.size(); t++) {
+		pair_statistics.add(partial_statistics[t]);
+	}
 	
-	size_t N_pc = point_correspondence.size();
+	// The sums were taken over the stored data, move them to its pose
+	pair_statistics = pair_statistics.transformed(level_rotation, level_translation);
 	
-	Eigen::Vector3d diff;
-	double sum = 0;
-	for(std::map<int,int>::iterator it = point_correspondence.begin();
-		it != point_correspondence.end(); ++it) {
-		diff = model_verts.row(it->second).transpose() - rotation*data_verts.row(it->first).transpose() - translation;
-		sum += diff.norm();
-	} sum /= N_pc;
+	pair_statistics.solve(rotation, translation);
 	
-	return sum;
 }
 
-void ICP_Solver::quaternion_to_matrix(Eigen::Vector4d q, Eigen::Matrix3d &R) {
+/*
+ * Point-to-plane step: one pass to set up the linearized 6x6 normal
+ * equations, then solve them. Returns false if the system is singular,
+ * in which case the caller falls back to point-to-point for this step.
+ */
+
+template <typename Scalar, int Layout>
+bool Basic_ICP_Solver<Scalar, Layout>::compute_plane_registration(Eigen::Vector3d &translation,
+											Eigen::Matrix3d &rotation) {
 	
-	R(0, 0) = q[0]*q[0] + q[1]*q[1] - q[2]*q[2] - q[3]*q[3];
-	R(1, 0) = 2*(q[1]*q[2] + q[0]*q[3]);
-	R(2, 0) = 2*(q[1]*q[3] - q[0]*q[2]);
+	size_t N_pc = correspondences.size();
+	const Eigen::Vector3d &center = model_index->centroid(current_level);
 	
-	R(0, 1) = 2*(q[1]*q[2] - q[0]*q[3]);
-	R(1, 1) = q[0]*q[0] - q[1]*q[1] + q[2]*q[2] - q[3]*q[3];
-	R(2, 1) = 2*(q[2]*q[3] + q[0]*q[1]);
+	partial_plane_systems.resize(thread_pool->size());
+	for (size_t t=0; t<partial_plane_systems.size(); t++) {
+		partial_plane_systems[t].clear();
+	}
 	
-	R(0, 2) = 2*(q[1]*q[3] + q[0]*q[2]);
-	R(1, 2) = 2*(q[2]*q[3] - q[0]*q[1]);
-	R(2, 2) = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+	thread_pool->parallel_for(N_pc, [&](size_t begin, size_t end, size_t thread_id) {
+		Plane_System local;
+		accumulate_plane_system(Points(level_data()), level_rotation, level_translation,
+								level_model(), model_index->normals(current_level),
+								correspondences, center, begin, end, local);
+		partial_plane_systems[thread_id].add(local);
+	});
 	
-	//R.transposeInPlace();
+	plane_system.clear();
+	for (size_t t=0; t<partial_plane_systems.size(); t++) {
+		plane_system.add(partial_plane_systems[t]);
+	}
+	
+	plane_solved = plane_system.solve(center, plane_update, rotation, translation);
+	return plane_solved;
+}
+
+/*
+ * Weighted RMS of the objective after moving the data by (rotation,
+ * translation): the point distances, or for point-to-plane the linearized
+ * plane distances. Read off the sums gathered in compute_registration,
+ * so the pairs are not visited again.
+ */
+
+template <typename Scalar, int Layout>
+double Basic_ICP_Solver<Scalar, Layout>::compute_rms_error(const Eigen::Vector3d &translation,
+						 const Eigen::Matrix3d &rotation) {
 	
+	if (plane_solved) {
+		return sqrt(plane_system.mean_squared_residual(plane_update));
+	}
+	return sqrt(pair_statistics.mean_squared_residual(rotation, translation));
 }
+
+#define INSTANTIATE_ICP_SOLVER(Scalar, Layout) \
+	template class Basic_ICP_Solver<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_ICP_SOLVER)
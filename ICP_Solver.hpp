@@ -9,42 +9,299 @@
 #ifndef ICP_Solver_hpp
 #define ICP_Solver_hpp
 
+#include <cstdint>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <vector>
 
 #include <Eigen/Core>
 #include <Eigen/Eigenvalues>
 
-#include "/usr/local/include/nanoflann/nanoflann.hpp"
+#include "Correspondence_Set.hpp"
+#include "Global_Initializer.hpp"
+#include "ICP_Config.hpp"
+#include "Iteration_Trace.hpp"
+#include "Model_Index.hpp"
+#include "Registration_Kernel.hpp"
+#include "Robust_Kernel.hpp"
+#include "Thread_Pool.hpp"
+#include "Voxel_Hash_Grid.hpp"
 
-typedef nanoflann::KDTreeEigenMatrixAdaptor<Eigen::MatrixXd, 3, nanoflann::metric_L1> kd_tree_t;
+/*
+ * What the registration step minimizes: the distance between the paired
+ * points, or the distance of each data point to the tangent plane of its
+ * model point.
+ */
 
-class ICP_Solver {
+enum ICP_Objective {
+	point_to_point = 0,
+	point_to_plane
+};
+
+/*
+ * How the closest model points are found: the exact kd-tree search, the
+ * kd-tree search with an error bound (see ICP_Solver::search_epsilon), or
+ * a voxel hash grid over the model that falls back on the kd-tree for
+ * points far from the surface. Only the approximate search can return
+ * another point than the nearest.
+ */
+
+enum Search_Backend {
+	exact_kd_tree = 0,
+	approximate_kd_tree,
+	voxel_hash_grid
+};
+
+/*
+ * Wall time spent in each phase of perform_icp(), in nanoseconds,
+ * summed over all iterations so far.
+ */
+
+struct Phase_Timings {
+	uint64_t tree_build = 0;
+	uint64_t initialization = 0;
+	uint64_t correspondence = 0;
+	uint64_t rejection = 0;
+	uint64_t registration = 0;
+	uint64_t error = 0;
+	
+	uint64_t total() const {
+		return tree_build + initialization + correspondence + rejection + registration + error;
+	}
+};
+
+/*
+ * Point-to-point or point-to-plane ICP of a data cloud onto a model.
+ *
+ * Vertices and the kd-tree are kept in Scalar (float or double) and the
+ * point layout 'Layout' (see Point_Storage.hpp); the registration sums and
+ * the transforms are always in double. ICP_Solver is the double precision
+ * solver on padded rows, ICP_Solver_f the single precision one.
+ *
+ * The choices that hold for a whole iteration (sampling, neighbour cache,
+ * robust kernel, trimming) pick a specialized instance of the per-point
+ * search and rejection loops once per iteration, rather than being asked
+ * again for every point.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Basic_ICP_Solver {
 public:
-	Eigen::MatrixXd data_verts; size_t N_data;
-	Eigen::MatrixXd model_verts;
-	std::map<int, int> point_correspondence;
-	std::map<int, double> weights;
+	typedef typename Point_Storage<Scalar, Layout>::Matrix Point_Matrix;
+	typedef Point_Cloud_Adaptor<Scalar, Layout> Points;
+	typedef Basic_Model_Index<Scalar, Layout> Model_Index_Type;
+	typedef basic_kd_tree_t<Scalar, Layout> kd_tree_type;
+	typedef Voxel_Hash_Grid<Scalar, Layout> Grid_Type;
 	
+	/*
+	 * The data cloud as it was handed in. Iterating only updates the pose
+	 * below, call transformed_data() to move the points themselves. Only
+	 * the first three columns are coordinates.
+	 */
+	Point_Matrix data_verts; size_t N_data;
+	Correspondence_Set correspondences;
+	
+	/*
+	 * The last step, and the pose p -> final_rotation p + final_translation
+	 * of the data. Iteration starts from the pose set here.
+	 */
 	Eigen::Vector3d translation, final_translation = Eigen::Vector3d::Zero();
 	Eigen::Matrix3d rotation, final_rotation = Eigen::Matrix3d::Identity();
 	bool iteration_has_converged = false;
 	
+	/* Print progress to std::cout, once per iteration from perform_icp() */
+	bool verbose = true;
+	
+	/* Iteration limits, sampling, rejection and search constants */
+	ICP_Config config;
+	
+	/*
+	 * Per-iteration instrumentation. When either is set, every iteration
+	 * is recorded (including kd-tree nodes visited) and handed to the
+	 * callback and/or appended to the trace. Nothing is recorded otherwise.
+	 */
+	std::function<void(const Iteration_Record &)> on_iteration;
+	std::shared_ptr<Iteration_Trace> trace;
+	
+	/* Threads used for the correspondence search, 0 means one per core */
+	size_t num_threads = 0;
+	
+	/*
+	 * Resolution levels to run through, 1 means full resolution only.
+	 * Together with base_voxel_size (0 derives it from the model), these
+	 * only apply when the solver builds its own Model_Index.
+	 */
+	size_t num_levels = 1;
+	double base_voxel_size = 0;
+	
+	/* Relative error change at which a coarse level hands over to the next */
+	double level_plateau = 0.01;
+	
+	ICP_Objective objective = point_to_point;
+	
+	/*
+	 * Weighting of the pairs, see Robust_Kernel.hpp. kernel_scale is the
+	 * scale of the M-estimators; 0 takes the RMS pair distance of the
+	 * previous iteration. With a scale at hand the weights are computed
+	 * right in the nearest-neighbour search.
+	 */
+	Robust_Kernel robust_kernel = sigma_rejection;
+	double kernel_scale = 0;
+	
+	/*
+	 * Trimmed ICP: the fraction of pairs kept every iteration, the closest
+	 * ones. Below 1 this replaces the sigma rule; set it to about the
+	 * overlap expected between partial scans.
+	 */
+	double overlap_ratio = 1;
+	
+	/*
+	 * Incremental correspondences: every data point remembers its two
+	 * nearest model points and where it was when it last searched. As long
+	 * as it has since moved less than half the gap between the two, the
+	 * nearest one cannot have changed and the search is skipped. Gives the
+	 * same pairs as a full search, at a fraction of the cost once the
+	 * iteration settles.
+	 */
+	bool incremental_search = true;
+	
+	/*
+	 * The nearest neighbour search. With approximate_kd_tree the squared
+	 * distance of a match is at most 1 + search_epsilon times that of the
+	 * nearest point; once the error levels off on the full meshes the
+	 * search turns exact for the remaining iterations.
+	 */
+	Search_Backend search_backend = exact_kd_tree;
+	double search_epsilon = 2;
+	
+	/*
+	 * Global initialization, for data that may start far from its place:
+	 * perform_icp() first runs short trials from many starting poses and
+	 * iterates from the best one. See Global_Initializer.hpp.
+	 */
+	bool global_initialization = false;
+	Global_Init_Options global_init;
+	
 private:
-	kd_tree_t *model_kd_tree;
+	// Only set until build_tree() turns them into a Model_Index
+	Point_Matrix model_source;
+	Eigen::MatrixXi model_source_faces;
+	std::shared_ptr<Model_Index_Type> owned_model_index;
+	const Model_Index_Type *model_index = nullptr;
+	
+	// coarse_data[l-1] is the data at the resolution of model level l
+	std::vector<Point_Matrix> coarse_data;
+	size_t current_level = 0;
+	
+	// The pose data_verts and coarse_data are stored in, and the motion
+	// from there to the current pose for the level in use, which the
+	// search and the registration apply on the fly
+	Eigen::Matrix3d stored_rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d stored_translation = Eigen::Vector3d::Zero();
+	Eigen::Matrix3d coarse_rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d coarse_translation = Eigen::Vector3d::Zero();
+	Eigen::Matrix3d level_rotation;
+	Eigen::Vector3d level_translation;
+	
+	// Voxel hash grid of every model level, built on first use. It is
+	// only asked while most points were in its reach the last iteration.
+	std::vector<std::shared_ptr<Grid_Type> > level_grids;
+	bool use_grid = true;
+	double grid_reach = 0;
+	
+	// Error bound of the current search, and whether the approximate
+	// search has handed over to the exact one
+	float level_epsilon = 0;
+	bool search_refined = false;
+	
+	std::shared_ptr<Thread_Pool> thread_pool;
+	
+	// Sums over the current correspondences, one partial per thread
+	Pair_Statistics pair_statistics;
+	std::vector<Pair_Statistics> partial_statistics;
+	
+	// The same for point-to-plane, plus the update solved from them
+	Plane_System plane_system;
+	std::vector<Plane_System> partial_plane_systems;
+	Plane_System::Vector6d plane_update;
+	bool plane_solved = false;
+	
+	Phase_Timings timings;
+	
+	// The iteration in progress, only filled in completely when instrumented
+	Iteration_Record record;
+	
+	// Distance statistics gathered during the search, one partial per thread
+	struct Distance_Sums {
+		double sum = 0;
+		double sq_sum = 0;
+		double max = 0;
+		size_t zero_weights = 0;
+		size_t reused = 0;
+		size_t in_grid_reach = 0;
+		
+		void add(const Distance_Sums &other);
+	};
+	std::vector<Distance_Sums> partial_sums;
+	
+	// Per data point of the current level: the query it last searched
+	// with and the distances to, and index of, its two nearest neighbours
+	struct Cached_Neighbors {
+		Scalar query[3] = {0, 0, 0};
+		Scalar first = 0, second = 0;
+		int index = -1;
+	};
+	std::vector<Cached_Neighbors> neighbor_cache;
+	bool use_neighbor_cache = false;
+	
+	// Rough bound on how far the last step moved the data, against the
+	// point spacing of the level, to tell when the cache will pay off
+	double last_motion = MAXFLOAT;
+	double level_spacing = 0;
+	double level_radius = -1;
+	Eigen::Vector3d level_center;
+	
+	// Kernel scale used inside the search, 0 if the weights have to wait
+	double search_scale = 0;
+	double estimated_scale = 0;
+	
+	// Copy of the distances for the trimming threshold
+	std::vector<double> trim_scratch;
 	
 	double error = MAXFLOAT;
 	double old_error = 0;
 	int iter_counter = 0;
-	const size_t max_it = 50;
-	const double tolerance = 0.000001;
-	const float sampling_quotient = 1.0;
 	
 public:
-	ICP_Solver();
-	ICP_Solver(Eigen::MatrixXd data_verts, Eigen::MatrixXd model_verts);
+	Basic_ICP_Solver();
+	
+	/*
+	 * Vertices in the solver's own storage are taken by value, pass
+	 * temporaries with std::move to avoid a copy. N x 3 matrices are
+	 * converted.
+	 */
+	Basic_ICP_Solver(Point_Matrix data_verts, Point_Matrix model_verts,
+					 const Eigen::MatrixXi &model_faces = Eigen::MatrixXi());
+	Basic_ICP_Solver(const Eigen::MatrixXd &data_verts, const Eigen::MatrixXd &model_verts,
+					 const Eigen::MatrixXi &model_faces = Eigen::MatrixXi());
+	
+	/*
+	 * Registers against a prebuilt model index, which can be shared by
+	 * any number of solvers and has to outlive this one.
+	 */
+	Basic_ICP_Solver(Point_Matrix data_verts, const Model_Index_Type &model_index);
+	Basic_ICP_Solver(const Eigen::MatrixXd &data_verts, const Model_Index_Type &model_index);
+	
 	void build_tree();
 	
+	/*
+	 * Moves the pose to the best one found by find_global_pose(). Called
+	 * by perform_icp() when global_initialization is set, or by hand
+	 * after build_tree() and before the first step.
+	 */
+	void find_initial_pose();
+	
 	/*
 	 * The main entry point for ICP alignment of the loaded meshes.
 	 * Iterates until convergence or maximum number of iterations is reached.
@@ -54,17 +311,75 @@ public:
 	
 	bool perform_icp();
 	
+	double get_error() const { return error; }
+	
+	int get_iterations() const { return iter_counter; }
+	
+	const Phase_Timings &get_timings() const { return timings; }
+	
+	/* The most recent iteration, complete only when instrumented */
+	const Iteration_Record &last_iteration() const { return record; }
+	
+	/*
+	 * Moves data_verts to the current pose, in place, and returns it.
+	 * Costs one pass over the points if the pose changed since the last
+	 * call and nothing otherwise.
+	 */
+	const Point_Matrix &transformed_data();
+	
 private:
+	void build_levels();
+	
+	Point_Matrix &level_data();
+	const Points &level_model() const;
+	const kd_tree_type &level_tree() const;
+	const Grid_Type *level_grid() const;
+	void build_level_grid();
+	
+	void transform_data(const Eigen::Matrix3d &rotation,
+						const Eigen::Vector3d &translation);
+	
+	void update_level_pose();
+	
 	void compute_closest_points();
 	
+	void measure_level();
+	
+	bool instrumented() const { return on_iteration || trace; }
+	
+	template <class Result_Set>
+	uint64_t dispatch_search(size_t begin, size_t end, Distance_Sums &sums);
+	
+	template <class Result_Set, bool Cached, Robust_Kernel Kernel>
+	uint64_t search_neighbors(size_t begin, size_t end, Distance_Sums &sums);
+	
+	// What the rejection pass goes by, from the distances of the search
+	struct Rejection_Bounds {
+		double mean = 0;
+		double max_deviation = 0;
+		double max_distance = 0;
+		double trim_distance = 0;
+		size_t ties_left = 0;
+		double weight_scale = 0;
+	};
+	
+	size_t dispatch_rejection(Rejection_Bounds &bounds, bool trim, bool set_weights);
+	
+	template <Robust_Kernel Kernel, bool Trim, bool Set_Weights>
+	size_t reject_pairs(Rejection_Bounds &bounds);
+	
 	void compute_registration(Eigen::Vector3d &translation,
 							  Eigen::Matrix3d &rotation);
 	
-	double compute_rms_error(Eigen::Vector3d translation,
-							 Eigen::Matrix3d rotation);
+	bool compute_plane_registration(Eigen::Vector3d &translation,
+									Eigen::Matrix3d &rotation);
 	
-	void quaternion_to_matrix(Eigen::Vector4d q, Eigen::Matrix3d &R);
+	double compute_rms_error(const Eigen::Vector3d &translation,
+							 const Eigen::Matrix3d &rotation);
 
 };
 
+typedef Basic_ICP_Solver<double> ICP_Solver;
+typedef Basic_ICP_Solver<float> ICP_Solver_f;
+
 #endif /* ICP_Solver_hpp */
@@ -0,0 +1,86 @@
+//
+//  Iteration_Trace.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <fstream>
+
+#include "Iteration_Trace.hpp"
+
+Iteration_Trace::Iteration_Trace(size_t capacity) : records(std::max<size_t>(capacity, 1)) {}
+
+void Iteration_Trace::push(const Iteration_Record &record) {
+	records[pushed % records.size()] = record;
+	pushed++;
+}
+
+void Iteration_Trace::clear() {
+	pushed = 0;
+}
+
+/* Trace event timestamps are in microseconds */
+static double micros(uint64_t ns) {
+	return ns * 1e-3;
+}
+
+static void write_slice(std::ostream &out, const char *name, uint64_t start, uint64_t duration,
+						int thread_id, const Iteration_Record &record) {
+	out << ",\n  {\"name\": \"" << name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread_id
+	<< ", \"ts\": " << micros(start) << ", \"dur\": " << micros(duration)
+	<< ", \"args\": {\"iteration\": " << record.iteration << "}}";
+}
+
+void Iteration_Trace::write_chrome_trace(std::ostream &out, int thread_id) const {
+
+	std::streamsize precision = out.precision(15);
+	out << "{\"traceEvents\": [\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+	<< thread_id << ", \"args\": {\"name\": \"ICP_Solver " << thread_id << "\"}}";
+
+	for (size_t i=0; i<size(); i++) {
+		const Iteration_Record &r = (*this)[i];
+		uint64_t end = r.start_ns + r.correspondence_ns + r.rejection_ns
+		+ r.registration_ns + r.error_ns;
+
+		out << ",\n  {\"name\": \"iteration\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread_id
+		<< ", \"ts\": " << micros(r.start_ns) << ", \"dur\": " << micros(end - r.start_ns)
+		<< ", \"args\": {\"iteration\": " << r.iteration
+		<< ", \"level\": " << r.level
+		<< ", \"error\": " << r.error
+		<< ", \"error_delta\": " << r.error_delta
+		<< ", \"sample_size\": " << r.sample_size
+		<< ", \"inliers\": " << r.inliers
+		<< ", \"rejection_ratio\": " << r.rejection_ratio
+		<< ", \"nodes_visited\": " << r.nodes_visited
+		<< ", \"reused\": " << r.reused << "}}";
+
+		uint64_t t = r.start_ns;
+		write_slice(out, "correspondence", t, r.correspondence_ns, thread_id, r);
+		t += r.correspondence_ns;
+		write_slice(out, "rejection", t, r.rejection_ns, thread_id, r);
+		t += r.rejection_ns;
+		write_slice(out, "registration", t, r.registration_ns, thread_id, r);
+		t += r.registration_ns;
+		write_slice(out, "error", t, r.error_ns, thread_id, r);
+
+		out << ",\n  {\"name\": \"error\", \"ph\": \"C\", \"pid\": 1, \"tid\": " << thread_id
+		<< ", \"ts\": " << micros(end) << ", \"args\": {\"error\": " << r.error << "}}"
+		<< ",\n  {\"name\": \"inliers\", \"ph\": \"C\", \"pid\": 1, \"tid\": " << thread_id
+		<< ", \"ts\": " << micros(end) << ", \"args\": {\"inliers\": " << r.inliers << "}}";
+	}
+
+	out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+	out.precision(precision);
+}
+
+bool Iteration_Trace::write_chrome_trace(const std::string &path, int thread_id) const {
+
+	std::ofstream out(path);
+	if (!out) {
+		std::cerr << "Could not write " << path << std::endl;
+		return false;
+	}
+	write_chrome_trace(out, thread_id);
+	return bool(out);
+}
@@ -0,0 +1,77 @@
+//
+//  Iteration_Trace.hpp
+//  icp_project
+//
+//
+
+#ifndef Iteration_Trace_hpp
+#define Iteration_Trace_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * What happened in one ICP iteration. Times are steady_clock nanoseconds;
+ * the phases run back to back in the order they are listed, starting at
+ * start_ns.
+ */
+
+struct Iteration_Record {
+	int iteration = 0;
+	size_t level = 0;				// resolution level, 0 is full resolution
+	double error = 0;
+	double error_delta = 0;			// change from the previous iteration
+	size_t sample_size = 0;			// correspondences searched for
+	size_t inliers = 0;				// correspondences left after rejection
+	double rejection_ratio = 0;		// rejected / sample_size, in [0, 1]
+	uint64_t nodes_visited = 0;		// kd-tree nodes touched by the search
+	size_t reused = 0;				// correspondences kept without a search
+
+	uint64_t start_ns = 0;
+	uint64_t correspondence_ns = 0;
+	uint64_t rejection_ns = 0;
+	uint64_t registration_ns = 0;
+	uint64_t error_ns = 0;
+};
+
+/*
+ * Ring buffer keeping the last 'capacity' iteration records of a solver.
+ * Not synchronized: give every solver its own trace.
+ */
+
+class Iteration_Trace {
+public:
+	Iteration_Trace(size_t capacity = 1024);
+
+	void push(const Iteration_Record &record);
+
+	void clear();
+
+	size_t size() const { return std::min(pushed, records.size()); }
+
+	/* Records overwritten because the buffer was full */
+	size_t dropped() const { return pushed - size(); }
+
+	/* Oldest record first */
+	const Iteration_Record &operator[](size_t i) const {
+		return records[(pushed - size() + i) % records.size()];
+	}
+
+	/*
+	 * Writes the records in the Chrome trace event format, which can be
+	 * opened in chrome://tracing or Perfetto. Every phase becomes a slice
+	 * on thread 'thread_id', error and inliers become counters.
+	 */
+	void write_chrome_trace(std::ostream &out, int thread_id = 1) const;
+
+	bool write_chrome_trace(const std::string &path, int thread_id = 1) const;
+
+private:
+	std::vector<Iteration_Record> records;
+	size_t pushed = 0;
+};
+
+#endif /* Iteration_Trace_hpp */
@@ -0,0 +1,125 @@
+//
+//  Job_Scheduler.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+
+#include "Job_Scheduler.hpp"
+
+// Index of the scheduler worker running on this thread, -1 elsewhere
+static thread_local int current_worker = -1;
+static thread_local const Job_Scheduler *current_scheduler = nullptr;
+
+Job_Scheduler::Job_Scheduler(size_t num_workers) : queued(0), next_queue(0) {
+
+	if (num_workers == 0) {
+		num_workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (size_t i=0; i<num_workers; i++) {
+		queues.push_back(std::unique_ptr<Job_Queue>(new Job_Queue));
+	}
+	for (size_t i=0; i<num_workers; i++) {
+		workers.push_back(std::thread(&Job_Scheduler::worker_loop, this, i));
+	}
+}
+
+Job_Scheduler::~Job_Scheduler() {
+
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shutting_down = true;
+	}
+	work_available.notify_all();
+
+	for (size_t i=0; i<workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void Job_Scheduler::submit(Job job) {
+
+	// Spread outside submissions round-robin, keep nested ones local
+	size_t q;
+	if (current_scheduler == this) {
+		q = current_worker;
+	} else {
+		q = next_queue++ % queues.size();
+	}
+
+	// Counted before it is queued: a nested job stolen and finished right
+	// away must not bring pending to 0 while its parent still runs
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending++;
+		queued++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[q]->mutex);
+		queues[q]->jobs.push_back(std::move(job));
+	}
+	work_available.notify_one();
+}
+
+void Job_Scheduler::wait() {
+
+	std::unique_lock<std::mutex> lock(mutex);
+	all_done.wait(lock, [this] { return pending == 0; });
+}
+
+bool Job_Scheduler::pop_or_steal(size_t worker_id, Job &job) {
+
+	// Newest job of our own queue first, it is likely to be warm in cache
+	{
+		Job_Queue &own = *queues[worker_id];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+
+	// Otherwise the oldest job of somebody else's
+	for (size_t k=1; k<queues.size(); k++) {
+		Job_Queue &victim = *queues[(worker_id + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Job_Scheduler::worker_loop(size_t worker_id) {
+
+	current_worker = (int) worker_id;
+	current_scheduler = this;
+
+	Job job;
+	while (true) {
+		if (pop_or_steal(worker_id, job)) {
+			queued--;
+			job();
+			job = Job();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0) {
+				all_done.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		work_available.wait(lock, [this] { return shutting_down || queued > 0; });
+		if (shutting_down && queued == 0) {
+			return;
+		}
+	}
+}
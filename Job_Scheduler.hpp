@@ -0,0 +1,91 @@
+//
+//  Job_Scheduler.hpp
+//  icp_project
+//
+//
+
+#ifndef Job_Scheduler_hpp
+#define Job_Scheduler_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs independent jobs, such as whole registrations, on a set of worker
+ * threads. Every worker has its own queue and takes jobs from its back;
+ * a worker that runs dry steals from the front of the others' queues.
+ * Jobs submitted from inside a job go to the submitting worker's queue.
+ */
+
+class Job_Scheduler {
+public:
+	typedef std::function<void()> Job;
+
+	Job_Scheduler(size_t num_workers = 0);
+	~Job_Scheduler();
+
+	size_t size() const { return workers.size(); }
+
+	void submit(Job job);
+
+	/* Blocks until every submitted job, including ones they submit, is done */
+	void wait();
+
+private:
+	struct Job_Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void worker_loop(size_t worker_id);
+	bool pop_or_steal(size_t worker_id, Job &job);
+
+	std::vector<std::unique_ptr<Job_Queue> > queues;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable work_available, all_done;
+	size_t pending = 0;
+	bool shutting_down = false;
+
+	std::atomic<size_t> queued;
+	std::atomic<size_t> next_queue;
+};
+
+/*
+ * Counts a limited resource, e.g. how many meshes may be in memory at once.
+ * acquire(n) takes n units in one go, so two jobs waiting for a pair of
+ * units can never hold one each and block each other.
+ */
+
+class Counting_Semaphore {
+public:
+	Counting_Semaphore(size_t count) : count(count) {}
+
+	void acquire(size_t n = 1) {
+		std::unique_lock<std::mutex> lock(mutex);
+		released.wait(lock, [&] { return count >= n; });
+		count -= n;
+	}
+
+	void release(size_t n = 1) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			count += n;
+		}
+		released.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable released;
+	size_t count;
+};
+
+#endif /* Job_Scheduler_hpp */
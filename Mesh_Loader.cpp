@@ -0,0 +1,955 @@
+//
+//  Mesh_Loader.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Mesh_Loader.hpp"
+
+// Files smaller than this are parsed on the calling thread alone
+static const size_t parallel_threshold = 1 << 20;
+
+/*
+ * A whole file, read only. Mapped where the platform allows it, read
+ * into memory otherwise.
+ */
+
+class Mapped_File {
+public:
+	Mapped_File(const std::string &path) {
+#ifdef _WIN32
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file) {
+			return;
+		}
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		buffer.resize(size);
+		if (size > 0 && fread(&buffer[0], 1, size, file) == size) {
+			data = &buffer[0];
+		}
+		fclose(file);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				data = (const char *) mapping;
+				size = st.st_size;
+				madvise(mapping, size, MADV_SEQUENTIAL);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~Mapped_File() {
+#ifndef _WIN32
+		if (data) {
+			munmap((void *) data, size);
+		}
+#endif
+	}
+
+	Mapped_File(const Mapped_File &) = delete;
+	Mapped_File &operator=(const Mapped_File &) = delete;
+
+	const char *begin() const { return data; }
+	const char *end() const { return data + size; }
+
+	const char *data = nullptr;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	std::vector<char> buffer;
+#endif
+};
+
+/*
+ * Text scanning. The mapping is not null terminated, so every helper
+ * stops at 'end', which is normally the end of the current line.
+ */
+
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+	while (p < end && is_blank(*p)) p++;
+	return p;
+}
+
+static const char *line_end(const char *p, const char *end) {
+	const char *newline = (const char *) memchr(p, '\n', end - p);
+	return newline ? newline : end;
+}
+
+static const char *next_line(const char *p, const char *end) {
+	const char *newline = (const char *) memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+/* Copies the next token to 'buffer' and advances past it */
+static bool next_token(const char *&p, const char *end, char (&buffer)[64]) {
+	p = skip_blanks(p, end);
+	size_t n = 0;
+	while (p + n < end && !is_blank(p[n]) && p[n] != '\n') n++;
+	if (n == 0 || n >= sizeof(buffer)) {
+		return false;
+	}
+	memcpy(buffer, p, n);
+	buffer[n] = 0;
+	p += n;
+	return true;
+}
+
+static bool parse_double(const char *&p, const char *end, double &value) {
+	char buffer[64];
+	char *stop;
+	if (!next_token(p, end, buffer)) {
+		return false;
+	}
+	value = strtod(buffer, &stop);
+	return stop != buffer;
+}
+
+/* Also reads the vertex index out of OBJ tokens like "12/4/12" */
+static bool parse_long(const char *&p, const char *end, long &value) {
+	char buffer[64];
+	char *stop;
+	if (!next_token(p, end, buffer)) {
+		return false;
+	}
+	value = strtol(buffer, &stop, 10);
+	return stop != buffer;
+}
+
+static size_t resolve_threads(size_t num_threads, size_t file_size) {
+	if (file_size < parallel_threshold) {
+		return 1;
+	}
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return num_threads;
+}
+
+/* Calls task(c) for c in [0, n) on n threads, the caller taking c = 0 */
+template <class Task>
+static void run_chunks(size_t n, const Task &task) {
+	std::vector<std::thread> threads;
+	for (size_t c=1; c<n; c++) {
+		threads.push_back(std::thread([&task, c] { task(c); }));
+	}
+	task(0);
+	for (size_t t=0; t<threads.size(); t++) {
+		threads[t].join();
+	}
+}
+
+/* Cuts [begin, end) into 'n' pieces, each starting at the start of a line */
+static std::vector<const char *> split_lines(const char *begin, const char *end, size_t n) {
+	std::vector<const char *> bounds(1, begin);
+	for (size_t c=1; c<n; c++) {
+		const char *p = begin + (end - begin) * c / n;
+		if (p > begin && p[-1] != '\n') {
+			p = next_line(p, end);
+		}
+		bounds.push_back(std::max(p, bounds.back()));
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+/* Splits a polygon into a fan of triangles */
+static void add_polygon(const long *indices, size_t n, std::vector<int> &triangles) {
+	for (size_t k=2; k<n; k++) {
+		triangles.push_back(indices[0]);
+		triangles.push_back(indices[k-1]);
+		triangles.push_back(indices[k]);
+	}
+}
+
+static bool gather_faces(const std::string &path, const std::vector<std::vector<int> > &chunks,
+						 size_t num_verts, Eigen::MatrixXi &faces) {
+	size_t total = 0;
+	for (size_t c=0; c<chunks.size(); c++) {
+		total += chunks[c].size();
+	}
+
+	faces.resize(total / 3, 3);
+	size_t f = 0;
+	for (size_t c=0; c<chunks.size(); c++) {
+		const std::vector<int> &triangles = chunks[c];
+		for (size_t i=0; i<triangles.size(); i+=3, f++) {
+			for (int k=0; k<3; k++) {
+				if (triangles[i+k] < 0 || triangles[i+k] >= (long) num_verts) {
+					std::cerr << path << " has a face with an invalid vertex index" << std::endl;
+					return false;
+				}
+				faces(f, k) = triangles[i+k];
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * OBJ: a first pass counts the vertex lines of every chunk, so that the
+ * second pass knows which rows of 'verts' its vertices go to.
+ */
+
+static bool is_command(const char *p, const char *end, char command) {
+	return end - p >= 2 && p[0] == command && is_blank(p[1]);
+}
+
+template <class Matrix>
+static bool read_obj(const std::string &path, const Mapped_File &file, Matrix &verts,
+					 Eigen::MatrixXi *faces, size_t num_threads) {
+
+	size_t n = resolve_threads(num_threads, file.size);
+	std::vector<const char *> bounds = split_lines(file.begin(), file.end(), n);
+
+	std::vector<size_t> first_vertex(n + 1, 0);
+	run_chunks(n, [&](size_t c) {
+		size_t count = 0;
+		for (const char *p = bounds[c]; p < bounds[c+1]; p = next_line(p, bounds[c+1])) {
+			if (is_command(skip_blanks(p, bounds[c+1]), bounds[c+1], 'v')) count++;
+		}
+		first_vertex[c+1] = count;
+	});
+	for (size_t c=0; c<n; c++) {
+		first_vertex[c+1] += first_vertex[c];
+	}
+
+	const size_t num_verts = first_vertex[n];
+	resize_points(verts, num_verts);
+
+	std::vector<std::vector<int> > triangles(n);
+	std::vector<char> ok(n, 1);
+
+	run_chunks(n, [&](size_t c) {
+		size_t row = first_vertex[c];
+		std::vector<long> polygon;
+
+		for (const char *p = bounds[c]; p < bounds[c+1]; p = next_line(p, bounds[c+1])) {
+			const char *end = line_end(p, bounds[c+1]);
+			const char *q = skip_blanks(p, end);
+
+			if (is_command(q, end, 'v')) {
+				q++;
+				double x, y, z;
+				if (!parse_double(q, end, x) || !parse_double(q, end, y) || !parse_double(q, end, z)) {
+					ok[c] = 0;
+					return;
+				}
+				verts(row, 0) = x;
+				verts(row, 1) = y;
+				verts(row, 2) = z;
+				row++;
+			} else if (faces && is_command(q, end, 'f')) {
+				q++;
+				polygon.clear();
+				long index;
+				while (skip_blanks(q, end) < end && parse_long(q, end, index)) {
+					// 1-based, or counted back from the last vertex so far
+					polygon.push_back(index > 0 ? index - 1 : (long) row + index);
+				}
+				add_polygon(polygon.data(), polygon.size(), triangles[c]);
+			}
+		}
+	});
+
+	if (std::find(ok.begin(), ok.end(), 0) != ok.end()) {
+		std::cerr << path << " has a malformed vertex line" << std::endl;
+		return false;
+	}
+	return !faces || gather_faces(path, triangles, num_verts, *faces);
+}
+
+/*
+ * PLY
+ */
+
+enum Ply_Type { ply_int8, ply_uint8, ply_int16, ply_uint16,
+				ply_int32, ply_uint32, ply_float32, ply_float64, ply_invalid };
+
+static Ply_Type ply_type(const std::string &name) {
+	if (name == "char" || name == "int8") return ply_int8;
+	if (name == "uchar" || name == "uint8") return ply_uint8;
+	if (name == "short" || name == "int16") return ply_int16;
+	if (name == "ushort" || name == "uint16") return ply_uint16;
+	if (name == "int" || name == "int32") return ply_int32;
+	if (name == "uint" || name == "uint32") return ply_uint32;
+	if (name == "float" || name == "float32") return ply_float32;
+	if (name == "double" || name == "float64") return ply_float64;
+	return ply_invalid;
+}
+
+static size_t ply_size(Ply_Type type) {
+	static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+	return sizes[type];
+}
+
+static double read_binary(const char *p, Ply_Type type, bool swap) {
+	unsigned char bytes[8];
+	size_t size = ply_size(type);
+	for (size_t k=0; k<size; k++) {
+		bytes[k] = p[swap ? size - 1 - k : k];
+	}
+
+	switch (type) {
+		case ply_int8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+		case ply_uint8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+		case ply_int16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+		case ply_uint16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+		case ply_int32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+		case ply_uint32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+		case ply_float32: { float v; memcpy(&v, bytes, 4); return v; }
+		case ply_float64: { double v; memcpy(&v, bytes, 8); return v; }
+		default: return 0;
+	}
+}
+
+struct Ply_Property {
+	std::string name;
+	Ply_Type type = ply_invalid;
+	bool is_list = false;
+	Ply_Type count_type = ply_invalid;
+};
+
+struct Ply_Element {
+	std::string name;
+	size_t count = 0;
+	std::vector<Ply_Property> properties;
+
+	/* Bytes per item in binary files, 0 if it has list properties */
+	size_t stride() const {
+		size_t size = 0;
+		for (size_t i=0; i<properties.size(); i++) {
+			if (properties[i].is_list) return 0;
+			size += ply_size(properties[i].type);
+		}
+		return size;
+	}
+
+	int find(const char *property) const {
+		for (size_t i=0; i<properties.size(); i++) {
+			if (properties[i].name == property) return (int) i;
+		}
+		return -1;
+	}
+
+	/* The vertex index list of a face element */
+	int index_list() const {
+		int i = find("vertex_indices");
+		return i >= 0 ? i : find("vertex_index");
+	}
+};
+
+enum Ply_Format { ply_ascii, ply_binary_little_endian, ply_binary_big_endian };
+
+static bool parse_ply_header(const Mapped_File &file, Ply_Format &format,
+							 std::vector<Ply_Element> &elements, const char *&body) {
+
+	const char *p = file.begin();
+	bool has_format = false;
+
+	while (p < file.end()) {
+		const char *end = line_end(p, file.end());
+		std::istringstream line(std::string(p, end));
+		p = next_line(p, file.end());
+
+		std::string keyword;
+		line >> keyword;
+
+		if (keyword == "format") {
+			std::string name;
+			line >> name;
+			has_format = true;
+			if (name == "ascii") format = ply_ascii;
+			else if (name == "binary_little_endian") format = ply_binary_little_endian;
+			else if (name == "binary_big_endian") format = ply_binary_big_endian;
+			else return false;
+		} else if (keyword == "element") {
+			Ply_Element element;
+			if (!(line >> element.name >> element.count)) return false;
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			if (elements.empty()) return false;
+			Ply_Property property;
+			std::string type;
+			line >> type;
+			if (type == "list") {
+				std::string count_type;
+				line >> count_type >> type;
+				property.is_list = true;
+				property.count_type = ply_type(count_type);
+				if (property.count_type == ply_invalid) return false;
+			}
+			property.type = ply_type(type);
+			if (property.type == ply_invalid || !(line >> property.name)) return false;
+			elements.back().properties.push_back(property);
+		} else if (keyword == "end_header") {
+			body = p;
+			return has_format;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Binary PLY. Fixed size vertices are converted in parallel row ranges,
+ * everything else is walked through item by item.
+ */
+
+template <class Matrix>
+static bool read_binary_ply(const std::string &path, const Mapped_File &file, Ply_Format format,
+							const std::vector<Ply_Element> &elements, const char *body,
+							Matrix &verts, Eigen::MatrixXi *faces, size_t num_threads) {
+
+	uint16_t one = 1;
+	bool big_endian_host = *(const unsigned char *) &one == 0;
+	bool swap = (format == ply_binary_big_endian) != big_endian_host;
+	const char *p = body;
+	const char *end = file.end();
+	bool have_verts = false, have_faces = !faces;
+	std::vector<std::vector<int> > triangles(1);
+
+	for (size_t e=0; e<elements.size() && !(have_verts && have_faces); e++) {
+		const Ply_Element &element = elements[e];
+		size_t stride = element.stride();
+
+		if (element.name == "vertex") {
+			int xyz[3] = {element.find("x"), element.find("y"), element.find("z")};
+			if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0 || stride == 0) {
+				std::cerr << path << ": vertices need fixed size x, y and z properties" << std::endl;
+				return false;
+			}
+			// Divided rather than multiplied, a forged count could wrap the product
+			if (element.count > (size_t) (end - p) / stride) {
+				break;
+			}
+
+			size_t offset[3];
+			Ply_Type type[3];
+			for (int k=0; k<3; k++) {
+				offset[k] = 0;
+				for (int i=0; i<xyz[k]; i++) offset[k] += ply_size(element.properties[i].type);
+				type[k] = element.properties[xyz[k]].type;
+			}
+
+			resize_points(verts, element.count);
+			size_t n = resolve_threads(num_threads, stride * element.count);
+			run_chunks(n, [&](size_t c) {
+				size_t row_end = element.count * (c + 1) / n;
+				for (size_t row = element.count * c / n; row<row_end; row++) {
+					const char *item = p + row * stride;
+					for (int k=0; k<3; k++) {
+						verts(row, k) = read_binary(item + offset[k], type[k], swap);
+					}
+				}
+			});
+			p += stride * element.count;
+			have_verts = true;
+			continue;
+		}
+
+		bool want = faces && element.name == "face" && element.index_list() >= 0;
+		if (!want && stride > 0) {
+			if (element.count > (size_t) (end - p) / stride) break;
+			p += stride * element.count;
+			continue;
+		}
+
+		// List properties make the items variable in size
+		int index_list = want ? element.index_list() : -1;
+		std::vector<long> polygon;
+		for (size_t item=0; item<element.count; item++) {
+			for (size_t i=0; i<element.properties.size(); i++) {
+				const Ply_Property &property = element.properties[i];
+				size_t count = 1;
+				if (property.is_list) {
+					if ((size_t) (end - p) < ply_size(property.count_type)) return false;
+					double length = read_binary(p, property.count_type, swap);
+					p += ply_size(property.count_type);
+					if (!(length >= 0) || length != std::floor(length) || length > (double) (end - p)) {
+						std::cerr << path << " has a malformed list length" << std::endl;
+						return false;
+					}
+					count = (size_t) length;
+				}
+				size_t size = ply_size(property.type);
+				if (count > (size_t) (end - p) / size) {
+					std::cerr << path << " is truncated" << std::endl;
+					return false;
+				}
+				if ((int) i == index_list) {
+					polygon.resize(count);
+					for (size_t k=0; k<count; k++) {
+						polygon[k] = (long) read_binary(p + k * size, property.type, swap);
+					}
+					add_polygon(polygon.data(), count, triangles[0]);
+				}
+				p += count * size;
+			}
+		}
+		have_faces = have_faces || want;
+	}
+
+	if (!have_verts) {
+		std::cerr << path << " has no vertices or is truncated" << std::endl;
+		return false;
+	}
+	return !faces || gather_faces(path, triangles, verts.rows(), *faces);
+}
+
+/*
+ * ASCII PLY has one item per line. A first pass counts the lines of every
+ * chunk, which tells the second pass which element and item each of its
+ * lines belongs to.
+ */
+
+template <class Matrix>
+static bool read_ascii_ply(const std::string &path, const Mapped_File &file,
+						   const std::vector<Ply_Element> &elements, const char *body,
+						   Matrix &verts, Eigen::MatrixXi *faces, size_t num_threads) {
+
+	// First line of every element, and the elements worth parsing
+	std::vector<size_t> first_line(elements.size() + 1, 0);
+	int vertex_element = -1, face_element = -1;
+	for (size_t e=0; e<elements.size(); e++) {
+		first_line[e+1] = first_line[e] + elements[e].count;
+		if (elements[e].name == "vertex" && vertex_element < 0) vertex_element = (int) e;
+		if (faces && elements[e].name == "face" && elements[e].index_list() >= 0 && face_element < 0) {
+			face_element = (int) e;
+		}
+	}
+	if (vertex_element < 0) {
+		std::cerr << path << " has no vertex element" << std::endl;
+		return false;
+	}
+
+	const Ply_Element &vertex = elements[vertex_element];
+	int xyz[3] = {vertex.find("x"), vertex.find("y"), vertex.find("z")};
+	if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0 ||
+		vertex.properties[xyz[0]].is_list || vertex.properties[xyz[1]].is_list ||
+		vertex.properties[xyz[2]].is_list) {
+		std::cerr << path << ": vertices need scalar x, y and z properties" << std::endl;
+		return false;
+	}
+
+	size_t last_line = first_line[std::max(vertex_element, face_element) + 1];
+
+	size_t n = resolve_threads(num_threads, file.end() - body);
+	std::vector<const char *> bounds = split_lines(body, file.end(), n);
+
+	std::vector<size_t> chunk_line(n + 1, 0);
+	run_chunks(n, [&](size_t c) {
+		size_t count = 0;
+		for (const char *p = bounds[c]; p < bounds[c+1]; p = next_line(p, bounds[c+1])) count++;
+		chunk_line[c+1] = count;
+	});
+	for (size_t c=0; c<n; c++) {
+		chunk_line[c+1] += chunk_line[c];
+	}
+	if (chunk_line[n] < last_line) {
+		std::cerr << path << " is truncated" << std::endl;
+		return false;
+	}
+
+	resize_points(verts, vertex.count);
+	std::vector<std::vector<int> > triangles(n);
+	std::vector<char> ok(n, 1);
+
+	run_chunks(n, [&](size_t c) {
+		size_t line = chunk_line[c];
+		std::vector<long> polygon;
+
+		for (const char *p = bounds[c]; p < bounds[c+1] && line < last_line;
+			 p = next_line(p, bounds[c+1]), line++) {
+
+			bool is_vertex = line >= first_line[vertex_element] && line < first_line[vertex_element + 1];
+			bool is_face = face_element >= 0 &&
+			line >= first_line[face_element] && line < first_line[face_element + 1];
+			if (!is_vertex && !is_face) {
+				continue;
+			}
+
+			const Ply_Element &element = elements[is_vertex ? vertex_element : face_element];
+			int index_list = is_face ? element.index_list() : -1;
+			size_t row = line - first_line[is_vertex ? vertex_element : face_element];
+			const char *end = line_end(p, bounds[c+1]);
+			const char *q = p;
+
+			for (size_t i=0; i<element.properties.size(); i++) {
+				const Ply_Property &property = element.properties[i];
+				double value;
+				long count = 1;
+				if (property.is_list && !parse_long(q, end, count)) {
+					ok[c] = 0;
+					return;
+				}
+				if ((int) i == index_list) {
+					polygon.resize(std::max(count, 0L));
+				}
+				for (long k=0; k<count; k++) {
+					if (!parse_double(q, end, value)) {
+						ok[c] = 0;
+						return;
+					}
+					if ((int) i == index_list) {
+						polygon[k] = (long) value;
+					}
+				}
+				if (is_vertex) {
+					for (int d=0; d<3; d++) {
+						if ((int) i == xyz[d]) verts(row, d) = value;
+					}
+				}
+			}
+			if (is_face) {
+				add_polygon(polygon.data(), polygon.size(), triangles[c]);
+			}
+		}
+	});
+
+	if (std::find(ok.begin(), ok.end(), 0) != ok.end()) {
+		std::cerr << path << " has a malformed element line" << std::endl;
+		return false;
+	}
+	return !faces || gather_faces(path, triangles, vertex.count, *faces);
+}
+
+template <class Matrix>
+static bool read_ply(const std::string &path, const Mapped_File &file, Matrix &verts,
+					 Eigen::MatrixXi *faces, size_t num_threads) {
+
+	Ply_Format format = ply_ascii;
+	std::vector<Ply_Element> elements;
+	const char *body = nullptr;
+	if (!parse_ply_header(file, format, elements, body)) {
+		std::cerr << path << " has an invalid PLY header" << std::endl;
+		return false;
+	}
+
+	if (format == ply_ascii) {
+		return read_ascii_ply(path, file, elements, body, verts, faces, num_threads);
+	}
+	return read_binary_ply(path, file, format, elements, body, verts, faces, num_threads);
+}
+
+template <class Matrix>
+static bool read_any(const std::string &path, Matrix &verts, Eigen::MatrixXi *faces,
+					 size_t num_threads) {
+
+	Mapped_File file(path);
+	if (!file.data) {
+		std::cerr << "Could not read " << path << std::endl;
+		return false;
+	}
+
+	if (faces) {
+		faces->resize(0, 3);
+	}
+
+	if (file.size >= 4 && memcmp(file.data, "ply", 3) == 0 && (file.data[3] == '\n' || file.data[3] == '\r')) {
+		return read_ply(path, file, verts, faces, num_threads);
+	}
+	return read_obj(path, file, verts, faces, num_threads);
+}
+
+template <class Matrix>
+bool read_mesh(const std::string &path, Matrix &verts, Eigen::MatrixXi &faces,
+			   size_t num_threads) {
+	return read_any(path, verts, &faces, num_threads);
+}
+
+template <class Matrix>
+bool read_points(const std::string &path, Matrix &verts, size_t num_threads) {
+	return read_any(path, verts, nullptr, num_threads);
+}
+
+template bool read_mesh(const std::string &, Eigen::MatrixXd &, Eigen::MatrixXi &, size_t);
+template bool read_points(const std::string &, Eigen::MatrixXd &, size_t);
+
+#define INSTANTIATE_MESH_LOADER(Scalar, Layout) \
+	template bool read_mesh(const std::string &, Point_Storage<Scalar, Layout>::Matrix &, \
+							Eigen::MatrixXi &, size_t); \
+	template bool read_points(const std::string &, Point_Storage<Scalar, Layout>::Matrix &, size_t);
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_MESH_LOADER)
+
+/*
+ * Point_Stream
+ */
+
+/* The x, y and z of an ASCII PLY vertex line, which may hold list properties */
+static bool parse_ply_vertex(const char *q, const char *end, const std::vector<char> &list_property,
+							 const int *xyz, double *point) {
+	for (size_t i=0; i<list_property.size(); i++) {
+		long count = 1;
+		if (list_property[i] && !parse_long(q, end, count)) {
+			return false;
+		}
+		for (long k=0; k<count; k++) {
+			double value;
+			if (!parse_double(q, end, value)) {
+				return false;
+			}
+			for (int d=0; d<3; d++) {
+				if ((int) i == xyz[d]) point[d] = value;
+			}
+		}
+	}
+	return true;
+}
+
+Point_Stream::Point_Stream(const std::string &path, size_t chunk_size) :
+	path(path), chunk(std::max<size_t>(chunk_size, 1)) {
+
+	// Only the header of a binary file is touched, a text file is scanned
+	// once for the lines the chunks start at
+	Mapped_File mapped(path);
+	if (!mapped.data) {
+		std::cerr << "Could not read " << path << std::endl;
+		return;
+	}
+
+	Ply_Format format = ply_ascii;
+	std::vector<Ply_Element> elements;
+	const char *body = nullptr;
+	bool ply = mapped.size >= 4 && memcmp(mapped.data, "ply", 3) == 0 &&
+	(mapped.data[3] == '\n' || mapped.data[3] == '\r');
+	if (ply && !parse_ply_header(mapped, format, elements, body)) {
+		std::cerr << path << " has an invalid PLY header" << std::endl;
+		return;
+	}
+
+	if (!ply) {
+		text = obj = true;
+		for (const char *p = mapped.begin(); p < mapped.end(); p = next_line(p, mapped.end())) {
+			if (is_command(skip_blanks(p, mapped.end()), mapped.end(), 'v')) {
+				if (count % chunk == 0) chunk_begin.push_back(p - mapped.begin());
+				count++;
+			}
+		}
+		chunk_begin.push_back(mapped.size);
+	} else if (format == ply_ascii) {
+		text = true;
+		size_t vertex_element = 0, skipped = 0;
+		while (vertex_element < elements.size() && elements[vertex_element].name != "vertex") {
+			skipped += elements[vertex_element++].count;
+		}
+		if (vertex_element == elements.size()) {
+			std::cerr << path << " has no vertex element" << std::endl;
+			return;
+		}
+
+		const Ply_Element &vertex = elements[vertex_element];
+		int xyz[3] = {vertex.find("x"), vertex.find("y"), vertex.find("z")};
+		if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0 ||
+			vertex.properties[xyz[0]].is_list || vertex.properties[xyz[1]].is_list ||
+			vertex.properties[xyz[2]].is_list) {
+			std::cerr << path << ": vertices need scalar x, y and z properties" << std::endl;
+			return;
+		}
+		for (int d=0; d<3; d++) {
+			xyz_property[d] = xyz[d];
+		}
+		for (size_t i=0; i<vertex.properties.size(); i++) {
+			list_property.push_back(vertex.properties[i].is_list);
+		}
+
+		// One item per line
+		const char *p = body;
+		for (size_t line=0; line<skipped && p < mapped.end(); line++) {
+			p = next_line(p, mapped.end());
+		}
+		for (size_t row=0; row<vertex.count; row++) {
+			if (p >= mapped.end()) {
+				std::cerr << path << " is truncated" << std::endl;
+				return;
+			}
+			if (row % chunk == 0) chunk_begin.push_back(p - mapped.begin());
+			p = next_line(p, mapped.end());
+		}
+		chunk_begin.push_back(p - mapped.begin());
+		count = vertex.count;
+	} else {
+		// Vertices can be found if every item before them has a fixed size
+		body_offset = body - mapped.begin();
+		size_t e = 0;
+		for (; e<elements.size() && elements[e].stride() > 0 && elements[e].name != "vertex"; e++) {
+			if (elements[e].count > (mapped.size - body_offset) / elements[e].stride()) {
+				break;
+			}
+			body_offset += elements[e].stride() * elements[e].count;
+		}
+		if (e == elements.size() || elements[e].name != "vertex" || elements[e].stride() == 0) {
+			std::cerr << path << ": only binary PLY vertices after fixed size elements can be streamed"
+			<< std::endl;
+			return;
+		}
+
+		const Ply_Element &element = elements[e];
+		int xyz[3] = {element.find("x"), element.find("y"), element.find("z")};
+		if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0) {
+			std::cerr << path << ": vertices need fixed size x, y and z properties" << std::endl;
+			return;
+		}
+		if (element.count > (mapped.size - body_offset) / element.stride()) {
+			std::cerr << path << " is truncated" << std::endl;
+			return;
+		}
+		for (int k=0; k<3; k++) {
+			field_offset[k] = 0;
+			for (int i=0; i<xyz[k]; i++) field_offset[k] += ply_size(element.properties[i].type);
+			field_type[k] = element.properties[xyz[k]].type;
+		}
+		stride = element.stride();
+		count = element.count;
+
+		uint16_t one = 1;
+		bool big_endian_host = *(const unsigned char *) &one == 0;
+		swap = (format == ply_binary_big_endian) != big_endian_host;
+	}
+
+#ifdef _WIN32
+	file = fopen(path.c_str(), "rb");
+	open = file != nullptr;
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	open = fd >= 0;
+#endif
+}
+
+Point_Stream::~Point_Stream() {
+#ifdef _WIN32
+	if (file) fclose(file);
+#else
+	if (fd >= 0) close(fd);
+#endif
+}
+
+/* The vertices on the lines of one chunk, false unless they fill 'verts' */
+template <class Matrix>
+bool Point_Stream::parse_text(const char *p, const char *end, Matrix &verts) {
+
+	size_t row = 0;
+	for (; p < end && row < (size_t) verts.rows(); p = next_line(p, end)) {
+		const char *line = line_end(p, end);
+		const char *q = skip_blanks(p, line);
+		double point[3];
+
+		if (obj) {
+			if (!is_command(q, line, 'v')) {
+				continue;
+			}
+			q++;
+			if (!parse_double(q, line, point[0]) || !parse_double(q, line, point[1]) ||
+				!parse_double(q, line, point[2])) {
+				return false;
+			}
+		} else if (!parse_ply_vertex(q, line, list_property, xyz_property, point)) {
+			return false;
+		}
+
+		for (int d=0; d<3; d++) {
+			verts(row, d) = point[d];
+		}
+		row++;
+	}
+	return row == (size_t) verts.rows();
+}
+
+template <class Matrix>
+bool Point_Stream::next(Matrix &verts) {
+
+	size_t rows = open ? std::min(chunk, count - position) : 0;
+	resize_points(verts, rows);
+	if (rows == 0) {
+		return false;
+	}
+
+	// Chunks of a text file start on the line of their first vertex
+	uint64_t begin = text ? chunk_begin[position / chunk] : body_offset + position * stride;
+	size_t length = text ? chunk_begin[position / chunk + 1] - begin : rows * stride;
+#ifdef _WIN32
+	std::vector<char> buffer(length);
+	if (_fseeki64(file, begin, SEEK_SET) != 0 || fread(&buffer[0], 1, length, file) != length) {
+		std::cerr << path << " is truncated" << std::endl;
+		resize_points(verts, 0);
+		return false;
+	}
+	const char *p = &buffer[0];
+#else
+	// Mappings start on a page boundary
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t aligned = begin - begin % page;
+	size_t mapped_length = length + (begin - aligned);
+	void *mapping = mmap(nullptr, mapped_length, PROT_READ, MAP_PRIVATE, fd, aligned);
+	if (mapping == MAP_FAILED) {
+		std::cerr << "Could not map " << path << std::endl;
+		resize_points(verts, 0);
+		return false;
+	}
+	madvise(mapping, mapped_length, MADV_SEQUENTIAL);
+	const char *p = (const char *) mapping + (begin - aligned);
+#endif
+
+	bool parsed = true;
+	if (text) {
+		parsed = parse_text(p, p + length, verts);
+	} else {
+		for (size_t row=0; row<rows; row++) {
+			const char *item = p + row * stride;
+			for (int k=0; k<3; k++) {
+				verts(row, k) = read_binary(item + field_offset[k], (Ply_Type) field_type[k], swap);
+			}
+		}
+	}
+
+#ifndef _WIN32
+	munmap(mapping, mapped_length);
+#endif
+	if (!parsed) {
+		std::cerr << path << " has a malformed vertex line" << std::endl;
+		resize_points(verts, 0);
+		return false;
+	}
+	position += rows;
+	return true;
+}
+
+template bool Point_Stream::next(Eigen::MatrixXd &);
+
+#define INSTANTIATE_POINT_STREAM(Scalar, Layout) \
+	template bool Point_Stream::next(Point_Storage<Scalar, Layout>::Matrix &);
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_POINT_STREAM)
@@ -0,0 +1,107 @@
+//
+//  Mesh_Loader.hpp
+//  icp_project
+//
+//
+
+#ifndef Mesh_Loader_hpp
+#define Mesh_Loader_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "Point_Storage.hpp"
+
+/*
+ * Reads an OBJ file or a PLY file (ASCII, binary little or big endian).
+ * The file is memory mapped and parsed straight into 'verts', in parallel
+ * chunks for large files. 'verts' is an N x 3 Eigen::MatrixXd or any
+ * Point_Storage matrix, so the vertices can be loaded directly in the
+ * storage the solver and Model_Index use. Polygons are split into
+ * triangle fans. PLY files without a face element, such as the range
+ * scans in mesh/, give an empty 'faces'.
+ *
+ * 'num_threads' = 0 means one thread per core. Returns false and prints
+ * the reason if the file can not be read.
+ */
+
+template <class Matrix>
+bool read_mesh(const std::string &path, Matrix &verts, Eigen::MatrixXi &faces,
+			   size_t num_threads = 0);
+
+/* The same, but skips the faces */
+template <class Matrix>
+bool read_points(const std::string &path, Matrix &verts, size_t num_threads = 0);
+
+/*
+ * The vertices of a point file, a chunk at a time, for clouds that do not
+ * fit in memory. Every chunk's bytes are mapped, parsed and unmapped again,
+ * so only that chunk is ever resident. OBJ and ASCII PLY files are scanned
+ * once on opening for the line each chunk starts at. Binary PLY files
+ * whose vertices follow a variable size element can not be streamed and
+ * are not opened.
+ */
+
+class Point_Stream {
+public:
+	explicit Point_Stream(const std::string &path, size_t chunk_size = 1 << 20);
+	~Point_Stream();
+
+	Point_Stream(const Point_Stream &) = delete;
+	Point_Stream &operator=(const Point_Stream &) = delete;
+
+	/* False if the file could not be read */
+	bool is_open() const { return open; }
+
+	/* Points in the file, and points per chunk */
+	size_t size() const { return count; }
+	size_t chunk_size() const { return chunk; }
+
+	/* Starts over at the first point */
+	void rewind() { position = 0; }
+
+	/*
+	 * Reads the next chunk into 'verts', any matrix read_points() takes.
+	 * Returns false, with 'verts' empty, once all points have been read.
+	 */
+	template <class Matrix>
+	bool next(Matrix &verts);
+
+private:
+	std::string path;
+	size_t chunk = 0;
+	size_t count = 0;
+	size_t position = 0;
+	bool open = false;
+
+	template <class Matrix>
+	bool parse_text(const char *p, const char *end, Matrix &verts);
+
+#ifdef _WIN32
+	FILE *file = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	// Binary PLY: where the vertices start, their size and x, y, z
+	uint64_t body_offset = 0;
+	size_t stride = 0;
+	size_t field_offset[3];
+	int field_type[3];
+	bool swap = false;
+
+	// OBJ and ASCII PLY: the offset of every chunk's first line and of the
+	// end of the last. For PLY which properties of a vertex line are lists,
+	// and which ones are x, y and z.
+	bool text = false;
+	bool obj = false;
+	std::vector<uint64_t> chunk_begin;
+	std::vector<char> list_property;
+	int xyz_property[3];
+};
+
+#endif /* Mesh_Loader_hpp */
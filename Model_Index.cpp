@@ -0,0 +1,340 @@
+//
+//  Model_Index.cpp
+//  icp_project
+//
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <Eigen/Eigenvalues>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Model_Index.hpp"
+#include "Voxel_Grid.hpp"
+
+const int dim = 3;
+
+// Neighbourhood size for normals fitted to the vertices
+const size_t normal_neighbours = 10;
+
+/*
+ * Index file layout: a header, one record per level, and then for every
+ * level its vertex and normal blocks in the index's point storage (page
+ * aligned, so they can be mapped) followed by the kd-tree as written by
+ * nanoflann's saveIndex().
+ */
+
+static const char index_magic[8] = {'I', 'C', 'P', 'I', 'D', 'X', '0', '3'};
+static const size_t page_size = 4096;
+
+struct Index_Header {
+	char magic[8];
+	uint64_t num_levels;
+	uint32_t scalar_size;
+	uint32_t layout;
+};
+
+struct Level_Record {
+	uint64_t rows;
+	double voxel_size;
+	uint64_t verts_offset;
+	uint64_t normals_offset;
+	uint64_t tree_offset;
+};
+
+template <typename Scalar, int Layout>
+Basic_Model_Index<Scalar, Layout>::Basic_Model_Index(Point_Matrix model_verts,
+											 const Eigen::MatrixXi &model_faces,
+											 size_t num_levels, double base_voxel_size,
+											 size_t max_leaf) :
+	leaf_size(max_leaf) {
+	build(std::move(model_verts), model_faces, num_levels, base_voxel_size);
+}
+
+template <typename Scalar, int Layout>
+Basic_Model_Index<Scalar, Layout>::Basic_Model_Index(const Eigen::MatrixXd &model_verts,
+											 const Eigen::MatrixXi &model_faces,
+											 size_t num_levels, double base_voxel_size,
+											 size_t max_leaf) :
+	leaf_size(max_leaf) {
+	build(to_points<Point_Matrix>(model_verts), model_faces, num_levels, base_voxel_size);
+}
+
+template <typename Scalar, int Layout>
+void Basic_Model_Index<Scalar, Layout>::build(Point_Matrix model_verts, const Eigen::MatrixXi &model_faces,
+										size_t num_levels, double base_voxel_size) {
+
+	double voxel_size = base_voxel_size;
+	if (voxel_size <= 0) {
+		voxel_size = 2 * estimate_point_spacing(model_verts);
+	}
+
+	// Downsample before the input is moved into level 0
+	std::vector<Point_Matrix> coarse;
+	std::vector<double> coarse_voxel_size;
+	for (size_t l=1; l<num_levels && voxel_size > 0; l++, voxel_size *= 2) {
+		Point_Matrix verts = voxel_downsample(model_verts, voxel_size);
+
+		// Too coarse to say anything about the alignment
+		if (verts.rows() < 2*dim) {
+			break;
+		}
+		coarse.push_back(std::move(verts));
+		coarse_voxel_size.push_back(voxel_size);
+	}
+
+	add_level(std::move(model_verts), 0, model_faces);
+	for (size_t l=0; l<coarse.size(); l++) {
+		add_level(std::move(coarse[l]), coarse_voxel_size[l]);
+	}
+}
+
+template <typename Scalar, int Layout>
+Basic_Model_Index<Scalar, Layout>::~Basic_Model_Index() {
+
+	// Trees refer to the mapped vertices, drop them first
+	levels.clear();
+
+	if (mapping) {
+#ifdef _WIN32
+		delete[] (char *) mapping;
+#else
+		munmap(mapping, mapping_size);
+#endif
+	}
+}
+
+template <typename Scalar, int Layout>
+void Basic_Model_Index<Scalar, Layout>::add_level(Point_Matrix verts, double voxel_size,
+											const Eigen::MatrixXi &faces) {
+
+	std::unique_ptr<Level> level(new Level);
+	level->storage = std::move(verts);
+	level->voxel_size = voxel_size;
+	level->centroid = level->storage.leftCols(3).colwise().mean().transpose().template cast<double>();
+	level->adaptor = Points(level->storage);
+
+	level->tree.reset(new kd_tree_type(dim, level->adaptor,
+		nanoflann::KDTreeSingleIndexAdaptorParams(leaf_size)));
+	level->tree->buildIndex();
+
+	estimate_normals(*level, faces, level->normal_storage);
+	level->normals = Points(level->normal_storage);
+
+	levels.push_back(std::move(level));
+}
+
+/*
+ * Area weighted average of the adjacent face normals. Vertices without
+ * faces get the normal of the plane through their nearest neighbours.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_Model_Index<Scalar, Layout>::estimate_normals(const Level &level, const Eigen::MatrixXi &faces,
+												   Point_Matrix &normals) {
+
+	const size_t N = level.adaptor.count;
+	const Points &verts = level.adaptor;
+
+	// Summed in double, stored in the index's own storage at the end
+	Eigen::MatrixXd sums = Eigen::MatrixXd::Zero(N, 3);
+
+	if (faces.cols() == 3 && faces.rows() > 0 && faces.maxCoeff() < (int) N) {
+		for (int f=0; f<faces.rows(); f++) {
+			Eigen::Vector3d a = verts.point(faces(f, 0));
+			Eigen::Vector3d b = verts.point(faces(f, 1));
+			Eigen::Vector3d c = verts.point(faces(f, 2));
+
+			// Twice the face area times its unit normal
+			Eigen::RowVector3d n = (b - a).cross(c - a).transpose();
+			for (int k=0; k<3; k++) {
+				sums.row(faces(f, k)) += n;
+			}
+		}
+	}
+
+	const size_t k = std::min(normal_neighbours, N);
+	std::vector<size_t> nn_index(k);
+	std::vector<Scalar> nn_distance(k);
+
+	for (size_t i=0; i<N; i++) {
+		double length = sums.row(i).norm();
+		if (length > 0) {
+			sums.row(i) /= length;
+			continue;
+		}
+
+		Scalar query_pt[dim] = {verts.coeff(i, 0), verts.coeff(i, 1), verts.coeff(i, 2)};
+		level.tree->knnSearch(query_pt, k, &nn_index[0], &nn_distance[0]);
+
+		Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+		for (size_t j=0; j<k; j++) {
+			mean += verts.point(nn_index[j]);
+		}
+		mean /= k;
+
+		Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+		for (size_t j=0; j<k; j++) {
+			Eigen::Vector3d d = verts.point(nn_index[j]) - mean;
+			covariance += d * d.transpose();
+		}
+
+		// Direction of least spread, eigenvalues come in increasing order
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(covariance);
+		sums.row(i) = eigen_solver.eigenvectors().col(0).transpose();
+	}
+
+	normals = to_points<Point_Matrix>(sums);
+}
+
+template <typename Scalar, int Layout>
+bool Basic_Model_Index<Scalar, Layout>::save(const std::string &path) const {
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cerr << "Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	const size_t point_size = Point_Storage<Scalar, Layout>::columns;
+
+	Index_Header header;
+	memcpy(header.magic, index_magic, sizeof(index_magic));
+	header.num_levels = levels.size();
+	header.scalar_size = sizeof(Scalar);
+	header.layout = Layout;
+	std::vector<Level_Record> records(levels.size());
+
+	// Records are filled in as the levels are written and rewritten at the end
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(&records[0], sizeof(Level_Record), records.size(), file);
+
+	for (size_t l=0; l<levels.size(); l++) {
+		const Level &level = *levels[l];
+
+		long offset = ftell(file);
+		std::vector<char> padding((page_size - offset % page_size) % page_size, 0);
+		fwrite(&padding[0], 1, padding.size(), file);
+
+		records[l].rows = level.adaptor.count;
+		records[l].voxel_size = level.voxel_size;
+		records[l].verts_offset = ftell(file);
+		fwrite(level.adaptor.points, sizeof(Scalar), point_size * level.adaptor.count, file);
+
+		records[l].normals_offset = ftell(file);
+		fwrite(level.normals.points, sizeof(Scalar), point_size * level.adaptor.count, file);
+
+		// saveIndex() only reads the tree but is not declared const
+		records[l].tree_offset = ftell(file);
+		const_cast<kd_tree_type &>(*level.tree).saveIndex(file);
+	}
+
+	fseek(file, sizeof(header), SEEK_SET);
+	fwrite(&records[0], sizeof(Level_Record), records.size(), file);
+
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+template <typename Scalar, int Layout>
+std::shared_ptr<Basic_Model_Index<Scalar, Layout> > Basic_Model_Index<Scalar, Layout>::load(const std::string &path) {
+
+	std::shared_ptr<Basic_Model_Index> index(new Basic_Model_Index());
+
+#ifdef _WIN32
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+	fseek(file, 0, SEEK_END);
+	index->mapping_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	index->mapping = new char[index->mapping_size];
+	size_t read = fread(index->mapping, 1, index->mapping_size, file);
+	fclose(file);
+	if (read != index->mapping_size) {
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Index_Header)) {
+		close(fd);
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+	void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+	index->mapping = mapping;
+	index->mapping_size = st.st_size;
+#endif
+
+	const char *base = (const char *) index->mapping;
+	const Index_Header *header = (const Index_Header *) base;
+	const Level_Record *records = (const Level_Record *) (header + 1);
+
+	if (memcmp(header->magic, index_magic, sizeof(index_magic)) != 0 ||
+		sizeof(Index_Header) + header->num_levels * sizeof(Level_Record) > index->mapping_size) {
+		std::cerr << path << " is not a model index" << std::endl;
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+	if (header->scalar_size != sizeof(Scalar) || header->layout != (uint32_t) Layout) {
+		std::cerr << path << " was saved with another scalar type or point layout" << std::endl;
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		return std::shared_ptr<Basic_Model_Index>();
+	}
+
+	const size_t point_size = Point_Storage<Scalar, Layout>::columns;
+	for (size_t l=0; l<header->num_levels; l++) {
+		const Level_Record &record = records[l];
+		size_t block_size = point_size * record.rows * sizeof(Scalar);
+		if (record.verts_offset + block_size > index->mapping_size ||
+			record.normals_offset + block_size > index->mapping_size) {
+			fclose(file);
+			std::cerr << path << " is truncated" << std::endl;
+			return std::shared_ptr<Basic_Model_Index>();
+		}
+
+		std::unique_ptr<Level> level(new Level);
+		level->voxel_size = record.voxel_size;
+		level->adaptor = Points((const Scalar *) (base + record.verts_offset), record.rows);
+		level->normals = Points((const Scalar *) (base + record.normals_offset), record.rows);
+		level->centroid = Eigen::Map<const Point_Matrix>(level->adaptor.points, record.rows, point_size)
+			.leftCols(3).colwise().mean().transpose().template cast<double>();
+
+		// The tree structure itself is small, read it back through nanoflann
+		level->tree.reset(new kd_tree_type(dim, level->adaptor,
+			nanoflann::KDTreeSingleIndexAdaptorParams(index->leaf_size)));
+		fseek(file, record.tree_offset, SEEK_SET);
+		level->tree->loadIndex(file);
+
+		index->levels.push_back(std::move(level));
+	}
+
+	fclose(file);
+	return index;
+}
+
+#define INSTANTIATE_MODEL_INDEX(Scalar, Layout) \
+	template class Basic_Model_Index<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_MODEL_INDEX)
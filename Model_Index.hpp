@@ -0,0 +1,127 @@
+//
+//  Model_Index.hpp
+//  icp_project
+//
+//
+
+#ifndef Model_Index_hpp
+#define Model_Index_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "/usr/local/include/nanoflann/nanoflann.hpp"
+
+#include "Point_Storage.hpp"
+
+/*
+ * kd-tree over a point cloud of the given storage. The distances it
+ * reports are squared Euclidean, in the same scalar type as the points.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+using basic_kd_tree_t = nanoflann::KDTreeSingleIndexAdaptor<
+	typename nanoflann::metric_L2::traits<Scalar, Point_Cloud_Adaptor<Scalar, Layout> >::distance_t,
+	Point_Cloud_Adaptor<Scalar, Layout>, 3>;
+
+typedef basic_kd_tree_t<double> kd_tree_t;
+
+/*
+ * The model mesh together with its kd-tree and vertex normals, and
+ * optionally a pyramid of voxel-downsampled copies with a kd-tree and
+ * normals each (see ICP_Solver::num_levels). Normals are averaged from the
+ * faces when there are any, and fitted to the nearest neighbours otherwise.
+ *
+ * A Model_Index is immutable once built, so any number of solvers, also
+ * on different threads, can search it at the same time. It can be written
+ * to disk with save() and brought back with load(), which maps the vertex
+ * data straight from the file instead of reading it into memory.
+ *
+ * Vertices, normals and the tree are kept in Scalar (float or double) and
+ * the point layout 'Layout'; see Point_Storage.hpp. Float halves the
+ * memory of the model and its tree. Model_Index is the double precision
+ * index with padded rows that ICP_Solver uses.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Basic_Model_Index {
+public:
+	typedef typename Point_Storage<Scalar, Layout>::Matrix Point_Matrix;
+	typedef Point_Cloud_Adaptor<Scalar, Layout> Points;
+	typedef basic_kd_tree_t<Scalar, Layout> kd_tree_type;
+
+	/*
+	 * Vertices in the index's own storage are taken by value, pass
+	 * temporaries with std::move. 'max_leaf' is the number of points per
+	 * kd-tree leaf.
+	 */
+	Basic_Model_Index(Point_Matrix model_verts,
+					  const Eigen::MatrixXi &model_faces = Eigen::MatrixXi(),
+					  size_t num_levels = 1, double base_voxel_size = 0, size_t max_leaf = 10);
+
+	/* Converts N x 3 vertices into the index's storage */
+	Basic_Model_Index(const Eigen::MatrixXd &model_verts,
+					  const Eigen::MatrixXi &model_faces = Eigen::MatrixXi(),
+					  size_t num_levels = 1, double base_voxel_size = 0, size_t max_leaf = 10);
+	~Basic_Model_Index();
+
+	Basic_Model_Index(const Basic_Model_Index &) = delete;
+	Basic_Model_Index &operator=(const Basic_Model_Index &) = delete;
+
+	bool save(const std::string &path) const;
+
+	/*
+	 * Returns an empty pointer if 'path' is not a readable index file, or
+	 * if it was saved with another scalar type or layout.
+	 */
+	static std::shared_ptr<Basic_Model_Index> load(const std::string &path);
+
+	size_t num_levels() const { return levels.size(); }
+
+	/* Voxel size level 'level' was downsampled with, 0 for the input itself */
+	double voxel_size(size_t level) const { return levels[level]->voxel_size; }
+
+	const Points &verts(size_t level = 0) const { return levels[level]->adaptor; }
+
+	/* Unit normals, point i belongs to vertex i of the same level */
+	const Points &normals(size_t level = 0) const { return levels[level]->normals; }
+
+	const Eigen::Vector3d &centroid(size_t level = 0) const { return levels[level]->centroid; }
+
+	const kd_tree_type &tree(size_t level = 0) const { return *levels[level]->tree; }
+
+private:
+	struct Level {
+		Point_Matrix storage;	// empty when the vertices are mapped
+		Point_Matrix normal_storage;
+		Points normals;
+		Eigen::Vector3d centroid;
+		double voxel_size = 0;
+		Points adaptor;
+		std::unique_ptr<kd_tree_type> tree;
+	};
+
+	Basic_Model_Index() {}
+
+	void build(Point_Matrix model_verts, const Eigen::MatrixXi &model_faces,
+			   size_t num_levels, double base_voxel_size);
+
+	void add_level(Point_Matrix verts, double voxel_size,
+				   const Eigen::MatrixXi &faces = Eigen::MatrixXi());
+
+	static void estimate_normals(const Level &level, const Eigen::MatrixXi &faces,
+								 Point_Matrix &normals);
+
+	std::vector<std::unique_ptr<Level> > levels;
+	size_t leaf_size = 10;
+
+	void *mapping = nullptr;
+	size_t mapping_size = 0;
+};
+
+typedef Basic_Model_Index<double> Model_Index;
+
+#endif /* Model_Index_hpp */
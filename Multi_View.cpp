@@ -0,0 +1,388 @@
+//
+//  Multi_View.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Geometry>
+
+#include "Job_Scheduler.hpp"
+#include "Multi_View.hpp"
+#include "Voxel_Grid.hpp"
+
+// Vertices per view the pose graph ties the views together with
+const size_t anchors_per_view = 128;
+
+Multi_View_Registration::Multi_View_Registration(std::vector<Eigen::MatrixXd> v) :
+	views(std::move(v)) {
+	rotations.assign(views.size(), Eigen::Matrix3d::Identity());
+	translations.assign(views.size(), Eigen::Vector3d::Zero());
+}
+
+Eigen::MatrixXd Multi_View_Registration::initial_view(size_t view) const {
+	Eigen::MatrixXd verts = views[view] * rotations[view].transpose();
+	verts.rowwise() += translations[view].transpose();
+	return verts;
+}
+
+static size_t find_root(std::vector<size_t> &parent, size_t v) {
+	while (parent[v] != v) {
+		v = parent[v] = parent[parent[v]];
+	}
+	return v;
+}
+
+/*
+ * Voxelizes every view on one common grid and counts, per pair of views,
+ * the voxels both occupy. Pairs only meet in the voxels they share, so the
+ * work follows the amount of overlap rather than the number of pairs.
+ */
+
+void Multi_View_Registration::build_overlap_graph() {
+
+	const size_t N = views.size();
+	edges.clear();
+	anchors.assign(N, Eigen::MatrixXd());
+	if (N < 2) {
+		return;
+	}
+
+	// Coarse enough that roughly aligned views still fall into the same voxels
+	double voxel_size = overlap_voxel_size;
+	if (voxel_size <= 0) {
+		for (size_t k=0; k<N; k++) {
+			if (views[k].rows() > 0) {
+				double diagonal = (views[k].colwise().maxCoeff() - views[k].colwise().minCoeff()).norm();
+				voxel_size += diagonal / (20 * N);
+			}
+		}
+	}
+
+	Eigen::RowVector3d origin = Eigen::RowVector3d::Constant(INFINITY);
+	for (size_t k=0; k<N; k++) {
+		if (views[k].rows() > 0) {
+			origin = origin.cwiseMin(initial_view(k).colwise().minCoeff());
+		}
+	}
+
+	// Views occupying every voxel, and the voxel count of every view
+	std::unordered_map<uint64_t, std::vector<size_t> > voxel_views;
+	std::vector<size_t> occupied(N, 0);
+
+	for (size_t k=0; k<N; k++) {
+		Eigen::MatrixXd verts = initial_view(k);
+
+		std::vector<uint64_t> keys(verts.rows());
+		for (long i=0; i<verts.rows(); i++) {
+			uint64_t key = 0;
+			for (int d=0; d<3; d++) {
+				uint64_t cell = (uint64_t) std::floor((verts(i, d) - origin(d)) / voxel_size);
+				key = (key << 21) | (cell & 0x1FFFFF);
+			}
+			keys[i] = key;
+		}
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		occupied[k] = keys.size();
+		for (size_t i=0; i<keys.size(); i++) {
+			voxel_views[keys[i]].push_back(k);
+		}
+
+		// Evenly spread anchor vertices
+		size_t num_anchors = std::min<size_t>(anchors_per_view, verts.rows());
+		anchors[k].resize(num_anchors, 3);
+		for (size_t a=0; a<num_anchors; a++) {
+			anchors[k].row(a) = verts.row(a * verts.rows() / num_anchors);
+		}
+	}
+
+	std::unordered_map<uint64_t, size_t> shared;
+	for (std::unordered_map<uint64_t, std::vector<size_t> >::const_iterator it = voxel_views.begin();
+		 it != voxel_views.end(); ++it) {
+		const std::vector<size_t> &in_voxel = it->second;
+		for (size_t a=0; a<in_voxel.size(); a++) {
+			for (size_t b=a+1; b<in_voxel.size(); b++) {
+				shared[((uint64_t) in_voxel[a] << 32) | in_voxel[b]]++;
+			}
+		}
+	}
+
+	std::vector<View_Edge> candidates;
+	for (std::unordered_map<uint64_t, size_t>::const_iterator it = shared.begin();
+		 it != shared.end(); ++it) {
+		View_Edge edge;
+		edge.model = it->first >> 32;
+		edge.data = it->first & 0xFFFFFFFF;
+		edge.overlap = double(it->second) / std::min(occupied[edge.model], occupied[edge.data]);
+		if (edge.overlap >= min_overlap) {
+			candidates.push_back(edge);
+		}
+	}
+
+	// Strongest overlaps first, so the capped degree keeps the best pairs
+	std::sort(candidates.begin(), candidates.end(), [](const View_Edge &a, const View_Edge &b) {
+		if (a.overlap != b.overlap) return a.overlap > b.overlap;
+		return std::make_pair(a.model, a.data) < std::make_pair(b.model, b.data);
+	});
+
+	std::vector<size_t> degree(N, 0);
+	std::vector<size_t> parent(N);
+	std::iota(parent.begin(), parent.end(), 0);
+
+	for (size_t e=0; e<candidates.size(); e++) {
+		const View_Edge &edge = candidates[e];
+		size_t root_model = find_root(parent, edge.model);
+		size_t root_data = find_root(parent, edge.data);
+
+		bool has_room = max_neighbors == 0 ||
+		(degree[edge.model] < max_neighbors && degree[edge.data] < max_neighbors);
+		if (!has_room && root_model == root_data) {
+			continue;
+		}
+
+		edges.push_back(edge);
+		degree[edge.model]++;
+		degree[edge.data]++;
+		parent[root_model] = root_data;
+	}
+
+	if (verbose) {
+		std::cout << "Overlap graph: " << edges.size() << " of " << candidates.size()
+		<< " overlapping pairs kept for " << N << " views" << std::endl;
+	}
+}
+
+void Multi_View_Registration::register_edge(View_Edge &edge, const Model_Index &model_index) {
+
+	Eigen::MatrixXd data_verts = initial_view(edge.data);
+
+	// Parallelism comes from running many pairs at once
+	ICP_Solver solver(std::move(data_verts), model_index);
+	solver.verbose = false;
+	solver.num_threads = 1;
+	solver.objective = objective;
+	solver.perform_icp();
+
+	// The rigid motion that took the data to where the solver left it
+	edge.rotation = solver.final_rotation;
+	edge.translation = solver.final_translation;
+	edge.iterations = solver.get_iterations();
+	edge.error = solver.get_error();
+	edge.evaluated = true;
+	edge.accepted = max_edge_error <= 0 || edge.error <= max_edge_error;
+}
+
+/*
+ * Registers every edge of the overlap graph on a Job_Scheduler. The model
+ * index of a view is built by the first of its edges to run and released
+ * after the last one, so only views with pending edges are held indexed.
+ */
+
+void Multi_View_Registration::register_edges() {
+
+	struct View_Index {
+		std::once_flag once;
+		std::shared_ptr<const Model_Index> index;
+		std::atomic<size_t> remaining;
+		View_Index() : remaining(0) {}
+	};
+
+	std::vector<std::unique_ptr<View_Index> > indices;
+	for (size_t k=0; k<views.size(); k++) {
+		indices.push_back(std::unique_ptr<View_Index>(new View_Index));
+	}
+	for (size_t e=0; e<edges.size(); e++) {
+		indices[edges[e].model]->remaining++;
+	}
+
+	Job_Scheduler scheduler(num_workers);
+	std::mutex log_mutex;
+
+	for (size_t e=0; e<edges.size(); e++) {
+		View_Edge &edge = edges[e];
+		View_Index &model = *indices[edge.model];
+
+		scheduler.submit([this, &edge, &model, &log_mutex] {
+			std::call_once(model.once, [&] {
+				model.index = std::make_shared<Model_Index>(initial_view(edge.model),
+															Eigen::MatrixXi(), num_levels);
+			});
+
+			register_edge(edge, *model.index);
+
+			if (--model.remaining == 0) {
+				model.index.reset();
+			}
+
+			if (verbose) {
+				std::lock_guard<std::mutex> lock(log_mutex);
+				std::cout << "View " << edge.data << " -> " << edge.model << ": error "
+				<< edge.error << " after " << edge.iterations << " iterations"
+				<< (edge.accepted ? "" : ", rejected") << std::endl;
+			}
+		});
+	}
+	scheduler.wait();
+}
+
+static Eigen::Matrix3d cross_matrix(const Eigen::Vector3d &v) {
+	Eigen::Matrix3d m;
+	m << 0, -v(2), v(1),
+	v(2), 0, -v(0),
+	-v(1), v(0), 0;
+	return m;
+}
+
+/*
+ * Finds a correction (R_k, t_k) of every view such that for each accepted
+ * edge the anchors of its data view land where the pairwise registration
+ * put them relative to the model view:
+ *
+ *     sum over edges, anchors s of the data view:  w |D_data s - D_model C s|^2
+ *
+ * with C the pairwise transform and D the corrections. Gauss-Newton with a
+ * small rotation update per view. The first view of every connected group
+ * (view 0 for the main one) is held fixed, so groups that overlap nothing
+ * else keep their initial placement.
+ */
+
+void Multi_View_Registration::optimize_pose_graph() {
+
+	const size_t N = views.size();
+	if (N < 2) {
+		return;
+	}
+
+	std::vector<size_t> parent(N);
+	std::iota(parent.begin(), parent.end(), 0);
+	for (size_t e=0; e<edges.size(); e++) {
+		if (edges[e].accepted) {
+			size_t a = find_root(parent, edges[e].model);
+			size_t b = find_root(parent, edges[e].data);
+			parent[std::max(a, b)] = std::min(a, b);
+		}
+	}
+
+	// Column of the 6 unknowns of every view that is not held fixed
+	const size_t fixed = (size_t) -1;
+	std::vector<size_t> column(N, fixed);
+	size_t M = 0;
+	for (size_t k=0; k<N; k++) {
+		if (find_root(parent, k) != k) {
+			column[k] = M;
+			M += 6;
+		}
+	}
+	if (M == 0) {
+		return;
+	}
+
+	// Errors below a hundredth of the model view's point spacing are noise,
+	// and an exact pair must not outweigh the others by orders of magnitude
+	std::vector<double> min_error(N, 1);
+	for (size_t k=0; k<N; k++) {
+		double spacing = estimate_point_spacing(views[k]);
+		if (spacing > 0) {
+			min_error[k] = 0.01 * spacing;
+		}
+	}
+
+	std::vector<Eigen::Matrix3d> R(N, Eigen::Matrix3d::Identity());
+	std::vector<Eigen::Vector3d> t(N, Eigen::Vector3d::Zero());
+	Eigen::MatrixXd H(M, M);
+	Eigen::VectorXd g(M);
+
+	for (size_t it=0; it<pose_graph_iterations; it++) {
+		H.setZero();
+		g.setZero();
+
+		for (size_t e=0; e<edges.size(); e++) {
+			const View_Edge &edge = edges[e];
+			if (!edge.accepted) {
+				continue;
+			}
+
+			const Eigen::MatrixXd &anchor = anchors[edge.data];
+			// Pairs that fit well and overlap a lot count most
+			double error = std::max(edge.error, min_error[edge.model]);
+			double w = edge.overlap / (anchor.rows() * error * error);
+			size_t i = edge.model, j = edge.data;
+
+			for (long s=0; s<anchor.rows(); s++) {
+				Eigen::Vector3d p = anchor.row(s).transpose();
+				Eigen::Vector3d a = R[j] * p + t[j];
+				Eigen::Vector3d b = R[i] * (edge.rotation * p + edge.translation) + t[i];
+				Eigen::Vector3d r = a - b;
+
+				// d r / d(omega, tau) for both ends
+				Eigen::Matrix<double, 3, 6> J[2];
+				J[0] << -cross_matrix(a), Eigen::Matrix3d::Identity();
+				J[1] << cross_matrix(b), -Eigen::Matrix3d::Identity();
+				size_t view[2] = {j, i};
+
+				for (int u=0; u<2; u++) {
+					if (column[view[u]] == fixed) continue;
+					size_t row = column[view[u]];
+					g.segment<6>(row) += w * J[u].transpose() * r;
+					for (int v=0; v<2; v++) {
+						if (column[view[v]] == fixed) continue;
+						size_t col = column[view[v]];
+						H.block<6, 6>(row, col) += w * J[u].transpose() * J[v];
+					}
+				}
+			}
+		}
+
+		// Only guards against anchors that do not pin a view down fully
+		double damping = 1e-9 * std::max(H.trace() / M, 1e-12);
+		H.diagonal().array() += damping;
+
+		Eigen::VectorXd delta = -H.ldlt().solve(g);
+		for (size_t k=0; k<N; k++) {
+			if (column[k] == fixed) continue;
+			Eigen::Vector3d omega = delta.segment<3>(column[k]);
+			Eigen::Vector3d tau = delta.segment<3>(column[k] + 3);
+
+			Eigen::Matrix3d dR = Eigen::Matrix3d::Identity();
+			if (omega.norm() > 0) {
+				dR = Eigen::AngleAxisd(omega.norm(), omega.normalized()).toRotationMatrix();
+			}
+			R[k] = dR * R[k];
+			t[k] = dR * t[k] + tau;
+		}
+
+		if (delta.norm() < 1e-12) {
+			break;
+		}
+	}
+
+	for (size_t k=0; k<N; k++) {
+		rotations[k] = R[k] * rotations[k];
+		translations[k] = R[k] * translations[k] + t[k];
+	}
+}
+
+bool Multi_View_Registration::register_views() {
+
+	build_overlap_graph();
+	register_edges();
+	optimize_pose_graph();
+
+	std::vector<bool> linked(views.size(), views.size() < 2);
+	for (size_t e=0; e<edges.size(); e++) {
+		if (edges[e].accepted) {
+			linked[edges[e].model] = linked[edges[e].data] = true;
+		}
+	}
+	return std::find(linked.begin(), linked.end(), false) == linked.end();
+}
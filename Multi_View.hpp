@@ -0,0 +1,108 @@
+//
+//  Multi_View.hpp
+//  icp_project
+//
+//
+
+#ifndef Multi_View_hpp
+#define Multi_View_hpp
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "ICP_Solver.hpp"
+
+/*
+ * A pair of views registered against each other. The pairwise result
+ * moves view 'data' onto view 'model', both taken at their initial poses.
+ */
+
+struct View_Edge {
+	size_t model = 0;
+	size_t data = 0;
+	double overlap = 0;		// shared occupied voxels / those of the smaller view
+
+	bool evaluated = false;
+	bool accepted = false;
+	int iterations = 0;
+	double error = 0;
+	Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+};
+
+/*
+ * Registers a whole set of scans at once. Views whose voxelized extents
+ * overlap are linked in an overlap graph, only the linked pairs are
+ * registered (in parallel, each view's Model_Index built on first use and
+ * dropped after its last pair), and a pose graph over the pairwise
+ * results then spreads the residual error evenly over all views instead
+ * of letting it build up along a chain.
+ *
+ * The scans should be roughly aligned already, through their own
+ * coordinates or through the initial poses in 'rotations' and
+ * 'translations'. View 0 stays where it is, and so does the first view of
+ * any group of views that overlaps none of the others.
+ */
+
+class Multi_View_Registration {
+public:
+	/* Per view, maps its vertices into the common frame. In: initial, out: final. */
+	std::vector<Eigen::Matrix3d> rotations;
+	std::vector<Eigen::Vector3d> translations;
+
+	/* Jobs running pairwise registrations at once, 0 means one per core */
+	size_t num_workers = 0;
+
+	ICP_Objective objective = point_to_point;
+	size_t num_levels = 1;
+
+	/* Side of the voxels the overlap is measured on, 0 means 1/20 of a scan's extent */
+	double overlap_voxel_size = 0;
+
+	/* Views sharing less than this fraction of voxels are not linked */
+	double min_overlap = 0.3;
+
+	/*
+	 * Most strongly overlapping neighbours registered per view, so the
+	 * number of pairs grows linearly with the views. Weaker edges are
+	 * still added where they are the only link between two groups.
+	 * 0 keeps every overlapping pair.
+	 */
+	size_t max_neighbors = 6;
+
+	/* Pairs ending with a larger RMS error are left out of the pose graph, 0 keeps all */
+	double max_edge_error = 0;
+
+	/* Gauss-Newton iterations of the pose graph */
+	size_t pose_graph_iterations = 10;
+
+	bool verbose = true;
+
+	Multi_View_Registration(std::vector<Eigen::MatrixXd> views);
+
+	/* Runs all stages, returns false if some view ended up without any accepted edge */
+	bool register_views();
+
+	/* The stages of register_views(), for callers that want to look in between */
+	void build_overlap_graph();
+	void register_edges();
+	void optimize_pose_graph();
+
+	const std::vector<View_Edge> &get_edges() const { return edges; }
+
+	size_t num_views() const { return views.size(); }
+
+private:
+	Eigen::MatrixXd initial_view(size_t view) const;
+
+	void register_edge(View_Edge &edge, const Model_Index &model_index);
+
+	std::vector<Eigen::MatrixXd> views;
+	std::vector<View_Edge> edges;
+
+	// Vertices of every view sampled for the pose graph, in the initial frame
+	std::vector<Eigen::MatrixXd> anchors;
+};
+
+#endif /* Multi_View_hpp */
@@ -0,0 +1,120 @@
+//
+//  Point_Storage.hpp
+//  icp_project
+//
+//
+
+#ifndef Point_Storage_hpp
+#define Point_Storage_hpp
+
+#include <cstddef>
+
+#include <Eigen/Core>
+
+/*
+ * How the solver and Model_Index keep their vertices in memory.
+ *
+ * row_major_padded stores every point as one block (x, y, z, 0) of four
+ * scalars, 16 bytes for float and 32 for double. Eigen aligns the buffer,
+ * so a point never straddles two cache lines and is read with a single
+ * vector load. column_major is Eigen's default N x 3 layout, where the
+ * coordinates of a point sit in three different columns.
+ */
+
+enum Point_Layout {
+	row_major_padded = 0,
+	column_major
+};
+
+template <typename Scalar, int Layout>
+struct Point_Storage;
+
+template <typename Scalar>
+struct Point_Storage<Scalar, row_major_padded> {
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 4, Eigen::RowMajor> Matrix;
+	static const int columns = 4;
+
+	static Scalar coeff(const Scalar *points, size_t, size_t i, int d) {
+		return points[4*i + d];
+	}
+};
+
+template <typename Scalar>
+struct Point_Storage<Scalar, column_major> {
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 3> Matrix;
+	static const int columns = 3;
+
+	static Scalar coeff(const Scalar *points, size_t count, size_t i, int d) {
+		return points[d*count + i];
+	}
+};
+
+/*
+ * Calls X(Scalar, Layout) for every supported storage, used by the
+ * translation units that instantiate their templates explicitly.
+ */
+
+#define FOR_EACH_POINT_STORAGE(X) \
+	X(float, row_major_padded) \
+	X(double, row_major_padded) \
+	X(float, column_major) \
+	X(double, column_major)
+
+/*
+ * Sizes 'points' for 'rows' points. The padding column, if there is one,
+ * is zeroed so that whole rows can be loaded and stored.
+ */
+
+template <class Matrix>
+void resize_points(Matrix &points, size_t rows) {
+	const int cols = Matrix::ColsAtCompileTime == Eigen::Dynamic ? 3 : Matrix::ColsAtCompileTime;
+	points.resize(rows, cols);
+	if (cols > 3) {
+		points.rightCols(cols - 3).setZero();
+	}
+}
+
+/* Copies the first three columns of 'verts' into the storage type 'Matrix' */
+template <class Matrix, class Derived>
+Matrix to_points(const Eigen::MatrixBase<Derived> &verts) {
+	Matrix points;
+	resize_points(points, verts.rows());
+	points.leftCols(3) = verts.leftCols(3).template cast<typename Matrix::Scalar>();
+	return points;
+}
+
+/*
+ * Read-only view of N points in either layout. Doubles as the nanoflann
+ * dataset adaptor, and works the same on an Eigen matrix or on vertices
+ * mapped from an index file.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+struct Point_Cloud_Adaptor {
+	typedef Point_Storage<Scalar, Layout> Storage;
+
+	const Scalar *points = nullptr;
+	size_t count = 0;
+
+	Point_Cloud_Adaptor() {}
+
+	Point_Cloud_Adaptor(const Scalar *points, size_t count) : points(points), count(count) {}
+
+	template <class Matrix>
+	Point_Cloud_Adaptor(const Matrix &verts) : points(verts.data()), count(verts.rows()) {}
+
+	Scalar coeff(size_t i, int d) const { return Storage::coeff(points, count, i, d); }
+
+	Eigen::Vector3d point(size_t i) const {
+		return Eigen::Vector3d(coeff(i, 0), coeff(i, 1), coeff(i, 2));
+	}
+
+	size_t kdtree_get_point_count() const { return count; }
+
+	Scalar kdtree_get_pt(size_t idx, int dim) const { return coeff(idx, dim); }
+
+	template <class BBOX>
+	bool kdtree_get_bbox(BBOX &) const { return false; }
+};
+
+#endif /* Point_Storage_hpp */
@@ -0,0 +1,518 @@
+//
+//  Registration_Kernel.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <atomic>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+
+#include "Registration_Kernel.hpp"
+
+// ICP_USE_AVX2 is set by the build for this file only
+#if defined(ICP_USE_AVX2) && (defined(__x86_64__) || defined(_M_X64))
+#define ICP_AVX2_KERNEL
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ICP_TARGET_AVX2
+#else
+#define ICP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+Pair_Statistics::Pair_Statistics() :
+	data_origin(Eigen::Vector3d::Zero()), model_origin(Eigen::Vector3d::Zero()) {
+	clear();
+}
+
+Pair_Statistics::Pair_Statistics(const Eigen::Vector3d &d, const Eigen::Vector3d &m) :
+	data_origin(d), model_origin(m) {
+	clear();
+}
+
+void Pair_Statistics::clear() {
+	weight_sum = 0;
+	data_sum.setZero();
+	model_sum.setZero();
+	cross_sum.setZero();
+	data_sq_sum = 0;
+	model_sq_sum = 0;
+}
+
+void Pair_Statistics::add(const Pair_Statistics &other) {
+	weight_sum += other.weight_sum;
+	data_sum += other.data_sum;
+	model_sum += other.model_sum;
+	cross_sum += other.cross_sum;
+	data_sq_sum += other.data_sq_sum;
+	model_sq_sum += other.model_sq_sum;
+}
+
+Eigen::Matrix3d Pair_Statistics::covariance() const {
+	// The same about any origin, take the small sums
+	return cross_sum / weight_sum - (data_sum / weight_sum) * (model_sum / weight_sum).transpose();
+}
+
+double Pair_Statistics::mean_squared_residual(const Eigen::Matrix3d &R,
+											  const Eigen::Vector3d &t) const {
+
+	// q - R p - t = q' - R p' - u with the origins folded into u
+	const Eigen::Vector3d u = t + R * data_origin - model_origin;
+
+	// sum w |q' - R p' - u|^2 expanded in terms of the accumulated sums
+	double sum = model_sq_sum + data_sq_sum + weight_sum * u.squaredNorm()
+	- 2 * (R * cross_sum).trace()
+	- 2 * u.dot(model_sum)
+	+ 2 * u.dot(R * data_sum);
+
+	// Guard against round-off when the residual is close to zero
+	return std::max(sum, 0.0) / weight_sum;
+}
+
+Pair_Statistics Pair_Statistics::transformed(const Eigen::Matrix3d &R,
+											 const Eigen::Vector3d &t) const {
+
+	// R p + t = R p' + (R data_origin + t), so only the origin takes the
+	// translation and the sums are rotated
+	Pair_Statistics moved = *this;
+	moved.data_origin = R * data_origin + t;
+	moved.data_sum = R * data_sum;
+	moved.cross_sum = R * cross_sum;
+	return moved;
+}
+
+static void quaternion_to_matrix(const Eigen::Vector4d &q, Eigen::Matrix3d &R) {
+
+	R(0, 0) = q[0]*q[0] + q[1]*q[1] - q[2]*q[2] - q[3]*q[3];
+	R(1, 0) = 2*(q[1]*q[2] + q[0]*q[3]);
+	R(2, 0) = 2*(q[1]*q[3] - q[0]*q[2]);
+
+	R(0, 1) = 2*(q[1]*q[2] - q[0]*q[3]);
+	R(1, 1) = q[0]*q[0] - q[1]*q[1] + q[2]*q[2] - q[3]*q[3];
+	R(2, 1) = 2*(q[2]*q[3] + q[0]*q[1]);
+
+	R(0, 2) = 2*(q[1]*q[3] + q[0]*q[2]);
+	R(1, 2) = 2*(q[2]*q[3] - q[0]*q[1]);
+	R(2, 2) = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+}
+
+void Pair_Statistics::solve(Eigen::Matrix3d &R, Eigen::Vector3d &t) const {
+
+	// Centres-of-mass of the pairs
+	Eigen::Vector3d data_COM = data_centroid();
+	Eigen::Vector3d model_COM = model_centroid();
+
+	// Construct covariance matrix
+	Eigen::Matrix3d covariance_matrix = covariance();
+
+	// Construct Q-matrix
+	Eigen::Matrix3d A = covariance_matrix - covariance_matrix.transpose();
+	Eigen::Vector3d delta;
+	delta << A(1, 2), A(2, 0), A(0, 1);
+
+	Eigen::Matrix4d Q;
+	double Q_trace = covariance_matrix.trace();
+	Q(0, 0) = Q_trace;
+	Q.block(1, 0, 3, 1) = delta;
+	Q.block(0, 1, 1, 3) = delta.transpose();
+	Q.block(1, 1, 3, 3) = covariance_matrix
+	+ covariance_matrix.transpose()
+	- Q_trace * Eigen::MatrixXd::Identity(3,3);
+
+	// Find optimal unit quaternion
+	Eigen::EigenSolver<Eigen::Matrix4d> eigen_solver(Q);
+	Eigen::MatrixXd::Index max_ev_index;
+	eigen_solver.eigenvalues().real().cwiseAbs().maxCoeff(&max_ev_index);
+	Eigen::Vector4d q_optimal = eigen_solver.eigenvectors().real().col(max_ev_index);
+
+	quaternion_to_matrix(q_optimal, R);
+	t = model_COM - R * data_COM;
+}
+
+#ifdef ICP_AVX2_KERNEL
+
+/*
+ * The vector kernels are compiled for AVX2 and FMA one function at a time,
+ * the rest of the library for the baseline instruction set, and they only
+ * run on CPUs that have both. They do not touch Eigen, so no Eigen code is
+ * built for AVX2 and its alignment stays that of the other translation
+ * units; the sums come out in plain arrays.
+ */
+
+struct Vector_Sums {
+	double weight = 0;
+	double data[3] = {0, 0, 0};
+	double model[3] = {0, 0, 0};
+	double cross[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+	double data_sq = 0;
+	double model_sq = 0;
+};
+
+static bool cpu_has_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool fma = info[2] & (1 << 12), os_saves = info[2] & (1 << 27), avx = info[2] & (1 << 28);
+	if (!fma || !os_saves || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static std::atomic<bool> &avx2_enabled() {
+	static std::atomic<bool> enabled(cpu_has_avx2());
+	return enabled;
+}
+
+static bool use_avx2() {
+	return avx2_enabled().load(std::memory_order_relaxed);
+}
+
+ICP_TARGET_AVX2 static inline __m256d madd(__m256d a, __m256d b, __m256d c) {
+	return _mm256_fmadd_pd(a, b, c);
+}
+
+ICP_TARGET_AVX2 static inline double horizontal_sum(__m256d v) {
+	__m128d low = _mm256_castpd256_pd128(v);
+	__m128d high = _mm256_extractf128_pd(v, 1);
+	low = _mm_add_pd(low, high);
+	return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+ICP_TARGET_AVX2 static inline __m256d gather(const double *base, __m128i index) {
+	return _mm256_i32gather_pd(base, index, 8);
+}
+
+ICP_TARGET_AVX2 static inline __m256d gather(const float *base, __m128i index) {
+	return _mm256_cvtps_pd(_mm_i32gather_ps(base, index, 4));
+}
+
+ICP_TARGET_AVX2 static inline __m256d load_point(const double *point) {
+	return _mm256_loadu_pd(point);
+}
+
+ICP_TARGET_AVX2 static inline __m256d load_point(const float *point) {
+	return _mm256_cvtps_pd(_mm_loadu_ps(point));
+}
+
+/*
+ * Column-major vertices: the lanes hold four different pairs, gathered
+ * from the three coordinate columns. Returns where the scalar loop has
+ * to pick up.
+ */
+
+template <typename Scalar>
+ICP_TARGET_AVX2 static size_t accumulate_column_major(const Scalar *data_points, size_t data_count,
+													  const Scalar *model_points, size_t model_count,
+													  const int *data_index, const int *model_index,
+													  const double *weight, size_t begin, size_t end,
+													  const double *data_origin, const double *model_origin,
+													  Vector_Sums &sums) {
+
+	// Column pointers of the column-major vertex matrices
+	const Scalar *px = data_points;
+	const Scalar *py = px + data_count;
+	const Scalar *pz = py + data_count;
+	const Scalar *qx = model_points;
+	const Scalar *qy = qx + model_count;
+	const Scalar *qz = qy + model_count;
+
+	__m256d w_sum = _mm256_setzero_pd();
+	__m256d p_sum[3], q_sum[3], c_sum[9];
+	for (int a=0; a<3; a++) {
+		p_sum[a] = q_sum[a] = _mm256_setzero_pd();
+	}
+	for (int a=0; a<9; a++) {
+		c_sum[a] = _mm256_setzero_pd();
+	}
+	__m256d pp_sum = _mm256_setzero_pd();
+	__m256d qq_sum = _mm256_setzero_pd();
+
+	__m256d p_origin[3], q_origin[3];
+	for (int a=0; a<3; a++) {
+		p_origin[a] = _mm256_set1_pd(data_origin[a]);
+		q_origin[a] = _mm256_set1_pd(model_origin[a]);
+	}
+
+	size_t k = begin;
+	for (; k + 4 <= end; k += 4) {
+		__m128i di = _mm_loadu_si128((const __m128i *)(data_index + k));
+		__m128i mi = _mm_loadu_si128((const __m128i *)(model_index + k));
+		__m256d w = _mm256_loadu_pd(weight + k);
+
+		__m256d p[3], q[3];
+		p[0] = _mm256_sub_pd(gather(px, di), p_origin[0]);
+		p[1] = _mm256_sub_pd(gather(py, di), p_origin[1]);
+		p[2] = _mm256_sub_pd(gather(pz, di), p_origin[2]);
+		q[0] = _mm256_sub_pd(gather(qx, mi), q_origin[0]);
+		q[1] = _mm256_sub_pd(gather(qy, mi), q_origin[1]);
+		q[2] = _mm256_sub_pd(gather(qz, mi), q_origin[2]);
+
+		w_sum = _mm256_add_pd(w_sum, w);
+		for (int a=0; a<3; a++) {
+			__m256d wp = _mm256_mul_pd(w, p[a]);
+			p_sum[a] = _mm256_add_pd(p_sum[a], wp);
+			q_sum[a] = madd(w, q[a], q_sum[a]);
+			pp_sum = madd(wp, p[a], pp_sum);
+			for (int b=0; b<3; b++) {
+				c_sum[3*a + b] = madd(wp, q[b], c_sum[3*a + b]);
+			}
+		}
+		__m256d qq = _mm256_mul_pd(q[0], q[0]);
+		qq = madd(q[1], q[1], qq);
+		qq = madd(q[2], q[2], qq);
+		qq_sum = madd(w, qq, qq_sum);
+	}
+
+	sums.weight = horizontal_sum(w_sum);
+	for (int a=0; a<3; a++) {
+		sums.data[a] = horizontal_sum(p_sum[a]);
+		sums.model[a] = horizontal_sum(q_sum[a]);
+	}
+	for (int a=0; a<9; a++) {
+		sums.cross[a] = horizontal_sum(c_sum[a]);
+	}
+	sums.data_sq = horizontal_sum(pp_sum);
+	sums.model_sq = horizontal_sum(qq_sum);
+
+	return k;
+}
+
+/*
+ * Padded rows: the lanes hold (x, y, z, 0) of one point, so every pair
+ * costs two plain loads instead of six gathers. The zero padding keeps
+ * the fourth lane of every sum at zero.
+ */
+
+template <typename Scalar>
+ICP_TARGET_AVX2 static size_t accumulate_padded(const Scalar *data_points, const Scalar *model_points,
+												const int *data_index, const int *model_index,
+												const double *weight, size_t begin, size_t end,
+												const double *data_origin, const double *model_origin,
+												Vector_Sums &sums) {
+
+	__m256d p_sum = _mm256_setzero_pd();
+	__m256d q_sum = _mm256_setzero_pd();
+	__m256d pp_sum = _mm256_setzero_pd();
+	__m256d qq_sum = _mm256_setzero_pd();
+	__m256d c_sum[3] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+	double w_sum = 0;
+
+	// The fourth lane of the origins is zero as well
+	__m256d p_origin = _mm256_setr_pd(data_origin[0], data_origin[1], data_origin[2], 0);
+	__m256d q_origin = _mm256_setr_pd(model_origin[0], model_origin[1], model_origin[2], 0);
+
+	for (size_t k=begin; k<end; k++) {
+		__m256d w = _mm256_set1_pd(weight[k]);
+		__m256d p = _mm256_sub_pd(load_point(data_points + 4 * (size_t) data_index[k]), p_origin);
+		__m256d q = _mm256_sub_pd(load_point(model_points + 4 * (size_t) model_index[k]), q_origin);
+
+		__m256d wp = _mm256_mul_pd(w, p);
+		__m256d wq = _mm256_mul_pd(w, q);
+		w_sum += weight[k];
+		p_sum = _mm256_add_pd(p_sum, wp);
+		q_sum = _mm256_add_pd(q_sum, wq);
+		pp_sum = madd(wp, p, pp_sum);
+		qq_sum = madd(wq, q, qq_sum);
+
+		// Row a of sum w p q^T is sum (w p_a) q
+		c_sum[0] = madd(_mm256_permute4x64_pd(wp, 0x00), q, c_sum[0]);
+		c_sum[1] = madd(_mm256_permute4x64_pd(wp, 0x55), q, c_sum[1]);
+		c_sum[2] = madd(_mm256_permute4x64_pd(wp, 0xAA), q, c_sum[2]);
+	}
+
+	double lanes[4];
+	sums.weight = w_sum;
+	_mm256_storeu_pd(lanes, p_sum);
+	std::copy(lanes, lanes + 3, sums.data);
+	_mm256_storeu_pd(lanes, q_sum);
+	std::copy(lanes, lanes + 3, sums.model);
+	for (int a=0; a<3; a++) {
+		_mm256_storeu_pd(lanes, c_sum[a]);
+		std::copy(lanes, lanes + 3, sums.cross + 3*a);
+	}
+	sums.data_sq = horizontal_sum(pp_sum);
+	sums.model_sq = horizontal_sum(qq_sum);
+
+	return end;
+}
+
+template <typename Scalar>
+static size_t accumulate_vectorized(const Point_Cloud_Adaptor<Scalar, column_major> &data_verts,
+									const Point_Cloud_Adaptor<Scalar, column_major> &model_verts,
+									const Correspondence_Set &pairs, size_t begin, size_t end,
+									const Pair_Statistics &stats, Vector_Sums &sums) {
+	return accumulate_column_major(data_verts.points, data_verts.count,
+								   model_verts.points, model_verts.count,
+								   &pairs.data_index[0], &pairs.model_index[0], &pairs.weight[0],
+								   begin, end, stats.data_origin.data(), stats.model_origin.data(), sums);
+}
+
+template <typename Scalar>
+static size_t accumulate_vectorized(const Point_Cloud_Adaptor<Scalar, row_major_padded> &data_verts,
+									const Point_Cloud_Adaptor<Scalar, row_major_padded> &model_verts,
+									const Correspondence_Set &pairs, size_t begin, size_t end,
+									const Pair_Statistics &stats, Vector_Sums &sums) {
+	return accumulate_padded(data_verts.points, model_verts.points,
+							 &pairs.data_index[0], &pairs.model_index[0], &pairs.weight[0],
+							 begin, end, stats.data_origin.data(), stats.model_origin.data(), sums);
+}
+
+#endif
+
+bool pair_statistics_vectorized() {
+#ifdef ICP_AVX2_KERNEL
+	return use_avx2();
+#else
+	return false;
+#endif
+}
+
+void set_pair_statistics_vectorized(bool enabled) {
+#ifdef ICP_AVX2_KERNEL
+	avx2_enabled().store(enabled && cpu_has_avx2());
+#else
+	(void) enabled;
+#endif
+}
+
+template <typename Scalar, int Layout>
+void accumulate_pair_statistics(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+								const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+								const Correspondence_Set &pairs,
+								size_t begin, size_t end,
+								Pair_Statistics &stats) {
+
+	size_t k = begin;
+
+#ifdef ICP_AVX2_KERNEL
+	if (use_avx2() && end > begin) {
+		Vector_Sums sums;
+		k = accumulate_vectorized(data_verts, model_verts, pairs, begin, end, stats, sums);
+
+		stats.weight_sum += sums.weight;
+		stats.data_sum += Eigen::Vector3d(sums.data[0], sums.data[1], sums.data[2]);
+		stats.model_sum += Eigen::Vector3d(sums.model[0], sums.model[1], sums.model[2]);
+		stats.cross_sum += Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> >(sums.cross);
+		stats.data_sq_sum += sums.data_sq;
+		stats.model_sq_sum += sums.model_sq;
+	}
+#endif
+
+	// Scalar path, also picks up the tail of the vector loop
+	for (; k<end; k++) {
+		const double w = pairs.weight[k];
+
+		Eigen::Vector3d p = data_verts.point(pairs.data_index[k]) - stats.data_origin;
+		Eigen::Vector3d q = model_verts.point(pairs.model_index[k]) - stats.model_origin;
+
+		stats.weight_sum += w;
+		stats.data_sum += w * p;
+		stats.model_sum += w * q;
+		stats.cross_sum.noalias() += (w * p) * q.transpose();
+		stats.data_sq_sum += w * p.squaredNorm();
+		stats.model_sq_sum += w * q.squaredNorm();
+	}
+}
+
+void Plane_System::clear() {
+	AtA.setZero();
+	Atb.setZero();
+	weight_sum = 0;
+	residual_sum = 0;
+}
+
+void Plane_System::add(const Plane_System &other) {
+	AtA += other.AtA;
+	Atb += other.Atb;
+	weight_sum += other.weight_sum;
+	residual_sum += other.residual_sum;
+}
+
+bool Plane_System::solve(const Eigen::Vector3d &center, Vector6d &x,
+						 Eigen::Matrix3d &R, Eigen::Vector3d &t) const {
+
+	Eigen::LDLT<Matrix6d> ldlt(AtA);
+	if (ldlt.info() != Eigen::Success || !ldlt.isPositive() ||
+		ldlt.vectorD().minCoeff() <= 1e-12 * ldlt.vectorD().maxCoeff()) {
+		return false;
+	}
+	x = ldlt.solve(Atb);
+
+	// Exact rotation for the small rotation vector r
+	Eigen::Vector3d r = x.head<3>();
+	double angle = r.norm();
+	R = angle > 0 ? Eigen::AngleAxisd(angle, r / angle).toRotationMatrix()
+				  : Eigen::Matrix3d::Identity();
+
+	// p -> R (p - center) + center + t'
+	t = x.tail<3>() + center - R * center;
+	return true;
+}
+
+double Plane_System::mean_squared_residual(const Vector6d &x) const {
+
+	double sum = residual_sum - 2 * x.dot(Atb) + x.dot(AtA * x);
+	return std::max(sum, 0.0) / weight_sum;
+}
+
+template <typename Scalar, int Layout>
+void accumulate_plane_system(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+							 const Eigen::Matrix3d &data_rotation,
+							 const Eigen::Vector3d &data_translation,
+							 const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+							 const Point_Cloud_Adaptor<Scalar, Layout> &model_normals,
+							 const Correspondence_Set &pairs,
+							 const Eigen::Vector3d &center,
+							 size_t begin, size_t end,
+							 Plane_System &system) {
+
+	const int *data_index = &pairs.data_index[0];
+	const int *model_index = &pairs.model_index[0];
+	const double *weight = &pairs.weight[0];
+
+	Plane_System::Vector6d a;
+
+	for (size_t k=begin; k<end; k++) {
+		const int i = data_index[k];
+		const int j = model_index[k];
+		const double w = weight[k];
+
+		Eigen::Vector3d p = data_rotation * data_verts.point(i) + data_translation;
+		Eigen::Vector3d q = model_verts.point(j);
+		Eigen::Vector3d n = model_normals.point(j);
+
+		a.head<3>() = (p - center).cross(n);
+		a.tail<3>() = n;
+		double b = (q - p).dot(n);
+
+		system.AtA.noalias() += (w * a) * a.transpose();
+		system.Atb += (w * b) * a;
+		system.weight_sum += w;
+		system.residual_sum += w * b * b;
+	}
+}
+
+#define INSTANTIATE_REGISTRATION_KERNEL(Scalar, Layout) \
+	template void accumulate_pair_statistics(const Point_Cloud_Adaptor<Scalar, Layout> &, \
+		const Point_Cloud_Adaptor<Scalar, Layout> &, const Correspondence_Set &, \
+		size_t, size_t, Pair_Statistics &); \
+	template void accumulate_plane_system(const Point_Cloud_Adaptor<Scalar, Layout> &, \
+		const Eigen::Matrix3d &, const Eigen::Vector3d &, const Point_Cloud_Adaptor<Scalar, Layout> &, \
+		const Point_Cloud_Adaptor<Scalar, Layout> &, \
+		const Correspondence_Set &, const Eigen::Vector3d &, size_t, size_t, Plane_System &);
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_REGISTRATION_KERNEL)
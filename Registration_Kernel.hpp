@@ -0,0 +1,149 @@
+//
+//  Registration_Kernel.hpp
+//  icp_project
+//
+//
+
+#ifndef Registration_Kernel_hpp
+#define Registration_Kernel_hpp
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "Correspondence_Set.hpp"
+#include "Point_Storage.hpp"
+
+/*
+ * Weighted sufficient statistics of a set of point-pairs (p, q), with p
+ * from the data mesh and q from the model mesh. Everything the rigid
+ * registration and its residual need can be read off these sums, so the
+ * point-pairs only have to be visited once per iteration.
+ *
+ * The sums are taken over p - data_origin and q - model_origin, written
+ * p' and q' below. With the origins near the clouds the sums stay small
+ * however far the clouds are from 0, and the covariance and residual do
+ * not come out as differences of large numbers.
+ */
+
+struct Pair_Statistics {
+	Eigen::Vector3d data_origin;
+	Eigen::Vector3d model_origin;
+	double weight_sum;			// sum w
+	Eigen::Vector3d data_sum;	// sum w p'
+	Eigen::Vector3d model_sum;	// sum w q'
+	Eigen::Matrix3d cross_sum;	// sum w p' q'^T
+	double data_sq_sum;			// sum w |p'|^2
+	double model_sq_sum;		// sum w |q'|^2
+
+	Pair_Statistics();
+
+	Pair_Statistics(const Eigen::Vector3d &data_origin, const Eigen::Vector3d &model_origin);
+
+	/* Zeroes the sums, the origins stay */
+	void clear();
+
+	/* Both have to be taken about the same origins */
+	void add(const Pair_Statistics &other);
+
+	Eigen::Vector3d data_centroid() const { return data_origin + data_sum / weight_sum; }
+
+	Eigen::Vector3d model_centroid() const { return model_origin + model_sum / weight_sum; }
+
+	/* Weighted cross-covariance of the pairs about their own centroids */
+	Eigen::Matrix3d covariance() const;
+
+	/* Weighted mean of |q - R p - t|^2 over the pairs */
+	double mean_squared_residual(const Eigen::Matrix3d &R,
+								 const Eigen::Vector3d &t) const;
+
+	/* The statistics of the same pairs with every p moved to R p + t, data_origin with them */
+	Pair_Statistics transformed(const Eigen::Matrix3d &R,
+								const Eigen::Vector3d &t) const;
+
+	/* The rigid transform (R, t) of least weighted residual, by Horn's method */
+	void solve(Eigen::Matrix3d &R, Eigen::Vector3d &t) const;
+};
+
+/*
+ * Adds the pairs [begin, end) of 'pairs' to 'stats', about the origins
+ * 'stats' was set up with. Vertices are read straight from the point
+ * storage, which may also map a model index file, and converted to double
+ * before they are accumulated. On CPUs with AVX2 and FMA, padded rows are
+ * read one point per load and column-major vertices are gathered four
+ * pairs at a time; otherwise a scalar loop does the work.
+ *
+ * Instantiated for every Point_Storage.
+ */
+
+/*
+ * Whether accumulate_pair_statistics() takes the AVX2 path. It is on
+ * wherever the CPU supports it; turning it off forces the scalar loop, so
+ * tools/icp_kernel_check.cpp can hold one against the other.
+ */
+
+bool pair_statistics_vectorized();
+void set_pair_statistics_vectorized(bool enabled);
+
+template <typename Scalar, int Layout>
+void accumulate_pair_statistics(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+								const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+								const Correspondence_Set &pairs,
+								size_t begin, size_t end,
+								Pair_Statistics &stats);
+
+/*
+ * Normal equations of the point-to-plane objective
+ *
+ *     sum w ((R p + t - q) . n)^2
+ *
+ * linearized around the identity, with n the model normal at q. The
+ * unknown is x = (r, t'), a small rotation vector r about 'center' and a
+ * translation t'. Each pair adds the row a = ((p - center) x n, n) with
+ * right hand side b = (q - p) . n.
+ */
+
+struct Plane_System {
+	typedef Eigen::Matrix<double, 6, 6, Eigen::DontAlign> Matrix6d;
+	typedef Eigen::Matrix<double, 6, 1, Eigen::DontAlign> Vector6d;
+
+	Matrix6d AtA;			// sum w a a^T
+	Vector6d Atb;			// sum w a b
+	double weight_sum;		// sum w
+	double residual_sum;	// sum w b^2
+
+	Plane_System() { clear(); }
+
+	void clear();
+
+	void add(const Plane_System &other);
+
+	/*
+	 * Solves for the update and turns it into a rigid transform of the
+	 * data. Returns false when the pairs do not pin down all six degrees
+	 * of freedom, e.g. when the model is a single plane.
+	 */
+	bool solve(const Eigen::Vector3d &center, Vector6d &x,
+			   Eigen::Matrix3d &R, Eigen::Vector3d &t) const;
+
+	/* Weighted mean of the linearized residual (a . x - b)^2 */
+	double mean_squared_residual(const Vector6d &x) const;
+};
+
+/*
+ * Adds the pairs [begin, end) of 'pairs' to 'system', with 'model_normals'
+ * holding the unit normal of every model vertex. Each data vertex p is
+ * taken to be at data_rotation p + data_translation.
+ */
+
+template <typename Scalar, int Layout>
+void accumulate_plane_system(const Point_Cloud_Adaptor<Scalar, Layout> &data_verts,
+							 const Eigen::Matrix3d &data_rotation,
+							 const Eigen::Vector3d &data_translation,
+							 const Point_Cloud_Adaptor<Scalar, Layout> &model_verts,
+							 const Point_Cloud_Adaptor<Scalar, Layout> &model_normals,
+							 const Correspondence_Set &pairs,
+							 const Eigen::Vector3d &center,
+							 size_t begin, size_t end,
+							 Plane_System &system);
+
+#endif /* Registration_Kernel_hpp */
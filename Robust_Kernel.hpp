@@ -0,0 +1,82 @@
+//
+//  Robust_Kernel.hpp
+//  icp_project
+//
+//
+
+#ifndef Robust_Kernel_hpp
+#define Robust_Kernel_hpp
+
+#include <cmath>
+
+/*
+ * How the point-pairs are weighted before the registration step.
+ *
+ * sigma_rejection is the original rule: pairs further than 1.5 standard
+ * deviations (ICP_Config::rejection_sigma) from the mean distance are
+ * dropped, and the rest weighted by 1 - d / max d. The others are
+ * M-estimators, solved by reweighting: a pair at distance d gets the
+ * weight w(d / s) of the kernel, with s the kernel scale (see
+ * ICP_Solver::kernel_scale).
+ */
+
+enum Robust_Kernel {
+	sigma_rejection = 0,
+	huber_kernel,
+	tukey_kernel,
+	cauchy_kernel,
+	geman_mcclure_kernel
+};
+
+/*
+ * Reweighting weight of a pair at distance 'd' under 'Kernel'. The tuning
+ * constants give 95% efficiency on Gaussian residuals of deviation 'scale'
+ * (Geman-McClure has none and is used as is). With the kernel fixed at
+ * compile time, hot loops get the formula without the switch.
+ */
+
+template <Robust_Kernel Kernel>
+inline double kernel_weight(double d, double scale) {
+
+	if (scale <= 0) {
+		return 1;
+	}
+	double u = std::abs(d) / scale;
+
+	switch (Kernel) {
+		case huber_kernel: {
+			const double k = 1.345;
+			return u <= k ? 1 : k / u;
+		}
+		case tukey_kernel: {
+			const double c = 4.685;
+			if (u >= c) return 0;
+			double v = 1 - (u / c) * (u / c);
+			return v * v;
+		}
+		case cauchy_kernel: {
+			const double c = 2.3849;
+			return 1 / (1 + (u / c) * (u / c));
+		}
+		case geman_mcclure_kernel: {
+			double v = 1 + u * u;
+			return 1 / (v * v);
+		}
+		default:
+			return 1;
+	}
+}
+
+/* The same for a kernel chosen at run time */
+inline double robust_weight(Robust_Kernel kernel, double d, double scale) {
+
+	switch (kernel) {
+		case huber_kernel: return kernel_weight<huber_kernel>(d, scale);
+		case tukey_kernel: return kernel_weight<tukey_kernel>(d, scale);
+		case cauchy_kernel: return kernel_weight<cauchy_kernel>(d, scale);
+		case geman_mcclure_kernel: return kernel_weight<geman_mcclure_kernel>(d, scale);
+		default: return 1;
+	}
+}
+
+#endif /* Robust_Kernel_hpp */
@@ -0,0 +1,269 @@
+//
+//  Streaming_Solver.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "Streaming_Solver.hpp"
+
+static uint64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Scalar, int Layout>
+void Basic_Streaming_Solver<Scalar, Layout>::Distance_Sums::add(const Distance_Sums &other) {
+	sum += other.sum;
+	sq_sum += other.sq_sum;
+	max = std::max(max, other.max);
+	count += other.count;
+}
+
+template <typename Scalar, int Layout>
+Basic_Streaming_Solver<Scalar, Layout>::Basic_Streaming_Solver(const std::string &data_path,
+														const Tiled_Index_Type &model_index,
+														size_t chunk_size) :
+	data(data_path, chunk_size), model_index(model_index) {}
+
+template <typename Scalar, int Layout>
+bool Basic_Streaming_Solver<Scalar, Layout>::perform_icp() {
+
+	if (!is_open()) {
+		return false;
+	}
+
+	while (step()) {
+		if (verbose) {
+			std::cout << "Iteration: " << iter_counter << ", Error: " << error
+			<< ", Rejected: " << 100 * record.rejection_ratio << "%" << std::endl;
+		}
+	}
+
+	if (iteration_has_converged) {
+		if (verbose) std::cout << "Iteration converged!" << std::endl;
+		return true;
+	} else {
+		if (verbose) std::cout << "Iteration did not converge.." << std::endl;
+		return false;
+	}
+}
+
+/*
+ * One pass over the data file: every chunk is paired up and added to the
+ * sums, then the step is solved from the sums alone.
+ */
+
+template <typename Scalar, int Layout>
+bool Basic_Streaming_Solver<Scalar, Layout>::step() {
+	const size_t max_it = config.max_iterations;
+	const double tolerance = config.tolerance;
+	double error_diff = std::abs(error-old_error);
+
+	if ((iter_counter < max_it) && !(error_diff < tolerance)) {
+
+		if (!thread_pool) {
+			thread_pool = std::make_shared<Thread_Pool>(num_threads);
+			cursors.resize(thread_pool->size());
+		}
+
+		uint64_t iteration_start = now_ns();
+		record = Iteration_Record();
+		record.start_ns = iteration_start;
+
+		// The pairs are summed about the model centroid, and about the data
+		// point the pose takes there, as the coordinates in the files may
+		// be far from 0
+		const Eigen::Vector3d &model_origin = model_index.centroid();
+		pair_statistics = Pair_Statistics(final_rotation.transpose() * (model_origin - final_translation),
+										  model_origin);
+		plane_system.clear();
+		sums = Distance_Sums();
+		rejected = 0;
+
+		data.rewind();
+		for (;;) {
+			uint64_t start = now_ns();
+			bool read = data.next(chunk);
+			record.correspondence_ns += now_ns() - start;
+			if (!read) break;
+
+			process_chunk();
+		}
+
+		if (pair_statistics.weight_sum <= 0) {
+			std::cerr << "No point-pairs left to register" << std::endl;
+			return false;
+		}
+
+		// Solve the step from the sums, point-to-point if the planes do not pin it down
+		uint64_t start = now_ns();
+		Plane_System::Vector6d plane_update;
+		bool plane_solved = objective == point_to_plane &&
+		plane_system.solve(model_index.centroid(), plane_update, rotation, translation);
+
+		// The sums were taken over the data as read, move them to its pose
+		Pair_Statistics moved = pair_statistics.transformed(final_rotation, final_translation);
+		if (!plane_solved) {
+			moved.solve(rotation, translation);
+		}
+
+		final_rotation = rotation * final_rotation;
+		final_translation = rotation * final_translation + translation;
+		record.registration_ns += now_ns() - start;
+
+		old_error = error;
+		start = now_ns();
+		error = plane_solved ? sqrt(plane_system.mean_squared_residual(plane_update))
+		: sqrt(moved.mean_squared_residual(rotation, translation));
+
+		// The next iteration weighs its pairs by these distances
+		mean = sums.sum / sums.count;
+		std_deviation = sqrt(std::max(sums.sq_sum / sums.count - mean * mean, 0.0));
+		rms = sqrt(sums.sq_sum / sums.count);
+		max_dist = sums.max;
+		have_distances = true;
+		record.error_ns = now_ns() - start;
+
+		timings.correspondence += record.correspondence_ns;
+		timings.rejection += record.rejection_ns;
+		timings.registration += record.registration_ns;
+		timings.error += record.error_ns;
+
+		record.iteration = iter_counter;
+		record.error = error;
+		record.error_delta = error - old_error;
+		record.inliers = record.sample_size - rejected;
+		record.rejection_ratio = double(rejected) / record.sample_size;
+		if (trace) trace->push(record);
+		if (on_iteration) on_iteration(record);
+
+		iter_counter++;
+
+	} else if (error_diff < tolerance) {
+		iteration_has_converged = true;
+		return false;
+	} else if (iter_counter >= max_it) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Pairs every point of the chunk with its nearest model point, weighs the
+ * pairs and adds them to the sums.
+ */
+
+template <typename Scalar, int Layout>
+void Basic_Streaming_Solver<Scalar, Layout>::process_chunk() {
+
+	const size_t N_chunk = chunk.rows();
+	const bool plane = objective == point_to_plane;
+
+	resize_points(matched, N_chunk);
+	if (plane) {
+		resize_points(matched_normals, N_chunk);
+	}
+	pairs.resize(N_chunk);
+	record.sample_size += N_chunk;
+	partial_sums.assign(thread_pool->size(), Distance_Sums());
+
+	// The chunk is searched where the current pose puts it
+	uint64_t start = now_ns();
+	thread_pool->parallel_for(N_chunk, [&](size_t begin, size_t end, size_t thread_id) {
+		typename Tiled_Index_Type::Cursor &cursor = cursors[thread_id];
+		typename Tiled_Index_Type::Match match;
+		Distance_Sums local;
+
+		for (size_t i=begin; i<end; i++) {
+			Eigen::Vector3d p(chunk(i, 0), chunk(i, 1), chunk(i, 2));
+			Eigen::Vector3d moved = final_rotation * p + final_translation;
+			Scalar query_pt[3] = {(Scalar) moved(0), (Scalar) moved(1), (Scalar) moved(2)};
+
+			pairs.data_index[i] = i;
+			pairs.model_index[i] = i;
+			if (!model_index.find_nearest(query_pt, cursor, match)) {
+				pairs.distance[i] = 0;
+				pairs.weight[i] = 0;
+				continue;
+			}
+
+			for (int d=0; d<3; d++) {
+				matched(i, d) = match.tile->verts().coeff(match.index, d);
+				if (plane) matched_normals(i, d) = match.tile->normals().coeff(match.index, d);
+			}
+
+			double distance = sqrt(match.distance);
+			pairs.distance[i] = distance;
+			pairs.weight[i] = 1;
+			local.sum += distance;
+			local.sq_sum += distance * distance;
+			local.max = std::max(local.max, distance);
+			local.count++;
+		}
+		partial_sums[thread_id].add(local);
+	});
+	for (size_t t=0; t<partial_sums.size(); t++) {
+		sums.add(partial_sums[t]);
+	}
+	uint64_t searched = now_ns();
+	record.correspondence_ns += searched - start;
+
+	// Reject and weigh as ICP_Solver does, with last iteration's distances
+	double cmp = config.rejection_sigma * std_deviation;
+	double weight_scale = kernel_scale > 0 ? kernel_scale : rms;
+	const std::vector<double> &distances = pairs.distance;
+	std::vector<double> &weights = pairs.weight;
+
+	rejected += pairs.compact([&](size_t j) {
+		const double d = distances[j];
+		if (weights[j] == 0) return false;
+		if (!have_distances) return true;
+
+		if (robust_kernel == sigma_rejection) {
+			if (std::abs(d - mean) > cmp) return false;
+			weights[j] = max_dist > 0 ? 1 - (d / max_dist) : 1;
+		} else {
+			weights[j] = robust_weight(robust_kernel, d, weight_scale);
+		}
+		return weights[j] > 0;
+	});
+	uint64_t weighed = now_ns();
+	record.rejection_ns += weighed - searched;
+
+	// Add the pairs kept to the sums
+	const size_t N_pc = pairs.size();
+	const Eigen::Vector3d &center = model_index.centroid();
+	const Pair_Statistics origins(pair_statistics.data_origin, pair_statistics.model_origin);
+	partial_statistics.assign(thread_pool->size(), origins);
+	partial_plane_systems.assign(thread_pool->size(), Plane_System());
+
+	thread_pool->parallel_for(N_pc, [&](size_t begin, size_t end, size_t thread_id) {
+		Pair_Statistics local = origins;
+		accumulate_pair_statistics(Points(chunk), Points(matched), pairs, begin, end, local);
+		partial_statistics[thread_id].add(local);
+
+		if (plane) {
+			Plane_System local_system;
+			accumulate_plane_system(Points(chunk), final_rotation, final_translation,
+									Points(matched), Points(matched_normals),
+									pairs, center, begin, end, local_system);
+			partial_plane_systems[thread_id].add(local_system);
+		}
+	});
+
+	for (size_t t=0; t<partial_statistics.size(); t++) {
+		pair_statistics.add(partial_statistics[t]);
+		plane_system.add(partial_plane_systems[t]);
+	}
+	record.registration_ns += now_ns() - weighed;
+}
+
+#define INSTANTIATE_STREAMING_SOLVER(Scalar, Layout) \
+	template class Basic_Streaming_Solver<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_STREAMING_SOLVER)
@@ -0,0 +1,135 @@
+//
+//  Streaming_Solver.hpp
+//  icp_project
+//
+//
+
+#ifndef Streaming_Solver_hpp
+#define Streaming_Solver_hpp
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "Correspondence_Set.hpp"
+#include "ICP_Solver.hpp"
+#include "Iteration_Trace.hpp"
+#include "Mesh_Loader.hpp"
+#include "Registration_Kernel.hpp"
+#include "Robust_Kernel.hpp"
+#include "Thread_Pool.hpp"
+#include "Tiled_Model_Index.hpp"
+
+/*
+ * ICP for clouds that do not fit in memory. The data cloud is read from
+ * its file a chunk at a time, every iteration, and the model is searched
+ * through a Tiled_Model_Index. Each chunk is paired up, weighted and added
+ * to the registration sums, and then dropped, so what stays in memory is
+ * one chunk, the tiles in use and the sums.
+ *
+ * The pairs of a whole iteration are never seen at once, so the rejection
+ * and the kernel scale go by the distances of the previous iteration; the
+ * first iteration keeps and weighs all pairs equally. Trimming, which needs
+ * all distances in order, is not available.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Basic_Streaming_Solver {
+public:
+	typedef typename Point_Storage<Scalar, Layout>::Matrix Point_Matrix;
+	typedef Point_Cloud_Adaptor<Scalar, Layout> Points;
+	typedef Basic_Tiled_Model_Index<Scalar, Layout> Tiled_Index_Type;
+
+	/* The last step, and the pose p -> final_rotation p + final_translation of the data */
+	Eigen::Vector3d translation, final_translation = Eigen::Vector3d::Zero();
+	Eigen::Matrix3d rotation, final_rotation = Eigen::Matrix3d::Identity();
+	bool iteration_has_converged = false;
+
+	/* As in ICP_Solver */
+	bool verbose = true;
+	std::function<void(const Iteration_Record &)> on_iteration;
+	std::shared_ptr<Iteration_Trace> trace;
+	size_t num_threads = 0;
+	ICP_Objective objective = point_to_point;
+	Robust_Kernel robust_kernel = sigma_rejection;
+	double kernel_scale = 0;
+
+	/* Of these only max_iterations, tolerance and rejection_sigma apply */
+	ICP_Config config;
+
+	/*
+	 * Registers the points in 'data_path' (any file Point_Stream reads)
+	 * against 'model_index', which has to outlive the solver. Points are
+	 * read 'chunk_size' at a time.
+	 */
+	Basic_Streaming_Solver(const std::string &data_path, const Tiled_Index_Type &model_index,
+						   size_t chunk_size = 1 << 20);
+
+	/* False if the data file could not be read */
+	bool is_open() const { return data.is_open(); }
+
+	bool step();
+
+	bool perform_icp();
+
+	double get_error() const { return error; }
+
+	int get_iterations() const { return iter_counter; }
+
+	/* Reading the data counts as correspondence time */
+	const Phase_Timings &get_timings() const { return timings; }
+
+	const Iteration_Record &last_iteration() const { return record; }
+
+private:
+	// Distances of one iteration's pairs, before rejection
+	struct Distance_Sums {
+		double sum = 0;
+		double sq_sum = 0;
+		double max = 0;
+		size_t count = 0;
+
+		void add(const Distance_Sums &other);
+	};
+
+	void process_chunk();
+
+	Point_Stream data;
+	const Tiled_Index_Type &model_index;
+	std::shared_ptr<Thread_Pool> thread_pool;
+
+	// One chunk: its points, the model point and normal each is paired
+	// with (row i belongs to point i) and the pairs kept
+	Point_Matrix chunk;
+	Point_Matrix matched, matched_normals;
+	Correspondence_Set pairs;
+	std::vector<typename Tiled_Index_Type::Cursor> cursors;
+	std::vector<Distance_Sums> partial_sums;
+
+	// Sums over the whole iteration, one partial per thread
+	Pair_Statistics pair_statistics;
+	std::vector<Pair_Statistics> partial_statistics;
+	Plane_System plane_system;
+	std::vector<Plane_System> partial_plane_systems;
+
+	// Distances of this iteration, and those the weights go by
+	Distance_Sums sums;
+	double mean = 0, std_deviation = 0, max_dist = 0, rms = 0;
+	bool have_distances = false;
+	size_t rejected = 0;
+
+	Phase_Timings timings;
+	Iteration_Record record;
+
+	double error = MAXFLOAT;
+	double old_error = 0;
+	int iter_counter = 0;
+};
+
+typedef Basic_Streaming_Solver<double> Streaming_Solver;
+typedef Basic_Streaming_Solver<float> Streaming_Solver_f;
+
+#endif /* Streaming_Solver_hpp */
@@ -0,0 +1,100 @@
+//
+//  Thread_Pool.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+
+#include "Thread_Pool.hpp"
+
+Thread_Pool::Thread_Pool(size_t n) : next_chunk(0) {
+
+	num_threads = n;
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// The caller acts as thread 0
+	for (size_t i=1; i<num_threads; i++) {
+		workers.push_back(std::thread(&Thread_Pool::worker_loop, this, i));
+	}
+}
+
+Thread_Pool::~Thread_Pool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shutting_down = true;
+	}
+	work_ready.notify_all();
+
+	for (size_t i=0; i<workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void Thread_Pool::parallel_for(size_t n, const Range_Task &task) {
+
+	if (n == 0) {
+		return;
+	}
+
+	// Not worth waking anybody up
+	if (workers.empty() || n <= chunk_size) {
+		task(0, n, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current_task = &task;
+		current_n = n;
+		next_chunk = 0;
+		busy_workers = workers.size();
+		generation++;
+	}
+	work_ready.notify_all();
+
+	run_chunks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [this] { return busy_workers == 0; });
+	current_task = nullptr;
+}
+
+void Thread_Pool::worker_loop(size_t thread_id) {
+
+	size_t seen_generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_ready.wait(lock, [&] {
+				return shutting_down || generation != seen_generation;
+			});
+			if (shutting_down) {
+				return;
+			}
+			seen_generation = generation;
+		}
+
+		run_chunks(thread_id);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy_workers--;
+		}
+		work_done.notify_one();
+	}
+}
+
+void Thread_Pool::run_chunks(size_t thread_id) {
+
+	const size_t n = current_n;
+
+	// Chunks are claimed dynamically since query cost varies over the cloud
+	size_t begin;
+	while ((begin = chunk_size * next_chunk++) < n) {
+		(*current_task)(begin, std::min(begin + chunk_size, n), thread_id);
+	}
+}
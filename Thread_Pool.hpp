@@ -0,0 +1,61 @@
+//
+//  Thread_Pool.hpp
+//  icp_project
+//
+//
+
+#ifndef Thread_Pool_hpp
+#define Thread_Pool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of worker threads for data-parallel loops.
+ * The calling thread takes part in the work, so a pool of size 1
+ * runs everything on the caller without any synchronization.
+ */
+
+class Thread_Pool {
+public:
+	typedef std::function<void(size_t begin, size_t end, size_t thread_id)> Range_Task;
+
+	/* Number of queries handed to a thread at a time */
+	static const size_t chunk_size = 512;
+
+	Thread_Pool(size_t num_threads = 0);
+	~Thread_Pool();
+
+	size_t size() const { return num_threads; }
+
+	/*
+	 * Splits [0, n) into chunks and calls 'task' on each of them from
+	 * the pool threads. 'thread_id' is in [0, size()) and is stable for
+	 * the duration of the call, so it can index per-thread scratch space.
+	 * Returns when all chunks are done.
+	 */
+	void parallel_for(size_t n, const Range_Task &task);
+
+private:
+	void worker_loop(size_t thread_id);
+	void run_chunks(size_t thread_id);
+
+	size_t num_threads;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable work_ready, work_done;
+	size_t generation = 0;
+	size_t busy_workers = 0;
+	bool shutting_down = false;
+
+	const Range_Task *current_task = nullptr;
+	size_t current_n = 0;
+	std::atomic<size_t> next_chunk;
+};
+
+#endif /* Thread_Pool_hpp */
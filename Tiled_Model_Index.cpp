@@ -0,0 +1,474 @@
+//
+//  Tiled_Model_Index.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "Mesh_Loader.hpp"
+#include "Tiled_Model_Index.hpp"
+
+/*
+ * Tile table layout: a header followed by one record per tile. Tile i is
+ * the model index file tile_<i>.icpidx in the same directory.
+ */
+
+static const char table_magic[8] = {'I', 'C', 'P', 'T', 'I', 'L', '0', '1'};
+static const char *table_name = "tiles.icptil";
+
+struct Table_Header {
+	char magic[8];
+	uint32_t scalar_size;
+	uint32_t layout;
+	uint64_t num_tiles;
+	uint64_t num_points;
+	double origin[3];
+	double cell;
+	double centroid[3];
+};
+
+struct Table_Record {
+	int64_t cell[3];
+	uint64_t rows;
+	double lower[3];
+	double upper[3];
+};
+
+static const int64_t cells_per_axis = int64_t(1) << 21;
+
+// Passes over the points spent on finding a fine enough tile grid
+static const int max_grid_passes = 16;
+
+// Points buffered per tile while the points are sorted into tiles, in total
+static const size_t scatter_buffer_points = 1 << 22;
+
+// Tiles a search cursor holds on to
+static const size_t cursor_tiles = 4;
+
+static bool seek(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+static void make_directory(const std::string &directory) {
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+/* Grid cell of 'p', clamped to the grid */
+static void cell_of(const double *p, const Eigen::Vector3d &origin, double cell, int64_t (&c)[3]) {
+	for (int d=0; d<3; d++) {
+		int64_t k = (int64_t) std::floor((p[d] - origin(d)) / cell);
+		c[d] = std::min(std::max<int64_t>(k, 0), cells_per_axis - 1);
+	}
+}
+
+static uint64_t pack_cell(const int64_t (&c)[3]) {
+	return (uint64_t(c[0]) << 42) | (uint64_t(c[1]) << 21) | uint64_t(c[2]);
+}
+
+/* Points in every occupied cell of the grid */
+static void count_cells(Point_Stream &stream, const Eigen::Vector3d &origin, double cell,
+						std::unordered_map<uint64_t, size_t> &counts) {
+
+	counts.clear();
+	Eigen::MatrixXd chunk;
+	stream.rewind();
+	while (stream.next(chunk)) {
+		for (int i=0; i<chunk.rows(); i++) {
+			double p[3] = {chunk(i, 0), chunk(i, 1), chunk(i, 2)};
+			int64_t c[3];
+			cell_of(p, origin, cell, c);
+			counts[pack_cell(c)]++;
+		}
+	}
+}
+
+template <typename Scalar, int Layout>
+std::string Basic_Tiled_Model_Index<Scalar, Layout>::tile_path(const std::string &directory, size_t i) {
+	char name[32];
+	snprintf(name, sizeof(name), "tile_%06zu.icpidx", i);
+	return directory + "/" + name;
+}
+
+template <typename Scalar, int Layout>
+bool Basic_Tiled_Model_Index<Scalar, Layout>::build(const std::string &points_path, const std::string &directory,
+											  size_t tile_points, size_t chunk_size) {
+
+	Point_Stream stream(points_path, chunk_size);
+	if (!stream.is_open() || stream.size() == 0) {
+		std::cerr << "No points in " << points_path << std::endl;
+		return false;
+	}
+	const size_t N = stream.size();
+	tile_points = std::max<size_t>(tile_points, 1);
+
+	// Bounds and centroid
+	Eigen::AlignedBox3d box;
+	Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+	Eigen::MatrixXd chunk;
+	while (stream.next(chunk)) {
+		for (int i=0; i<chunk.rows(); i++) {
+			Eigen::Vector3d p = chunk.row(i).transpose();
+			box.extend(p);
+			sum += p;
+		}
+	}
+	Eigen::Vector3d origin = box.min();
+	double extent = std::max(box.sizes().maxCoeff(), 1e-12);
+
+	// Start from the cell size that gives tiles of about tile_points on a
+	// sampled surface, and halve it until no tile is more than twice that
+	double target_tiles = std::max(1.0, double(N) / tile_points);
+	double cell = extent / std::max(1.0, std::floor(std::sqrt(target_tiles)));
+	const double min_cell = extent / (cells_per_axis - 1);
+	std::unordered_map<uint64_t, size_t> counts;
+	for (int pass=0; ; pass++) {
+		count_cells(stream, origin, cell, counts);
+
+		size_t largest = 0;
+		for (auto &c : counts) largest = std::max(largest, c.second);
+		if (largest <= 2 * tile_points || pass + 1 == max_grid_passes || cell / 2 < min_cell) {
+			break;
+		}
+		cell /= 2;
+	}
+
+	// Tiles in cell order, and where each starts in the scratch file
+	std::vector<uint64_t> keys;
+	keys.reserve(counts.size());
+	for (auto &c : counts) keys.push_back(c.first);
+	std::sort(keys.begin(), keys.end());
+
+	const size_t T = keys.size();
+	std::unordered_map<uint64_t, int> tile_of_key;
+	std::vector<uint64_t> first_row(T + 1, 0);
+	for (size_t t=0; t<T; t++) {
+		tile_of_key[keys[t]] = (int) t;
+		first_row[t + 1] = first_row[t] + counts[keys[t]];
+	}
+	counts.clear();
+
+	make_directory(directory);
+	std::string scratch_path = directory + "/points.tmp";
+	FILE *scratch = fopen(scratch_path.c_str(), "w+b");
+	if (!scratch) {
+		std::cerr << "Could not open " << scratch_path << " for writing" << std::endl;
+		return false;
+	}
+
+	// Sort the points into tiles through a small buffer per tile
+	const size_t buffer_points = std::max<size_t>(64, scatter_buffer_points / T);
+	std::vector<std::vector<Scalar> > buffers(T);
+	std::vector<uint64_t> written(T, 0);
+	std::vector<Eigen::AlignedBox3d> bounds(T);
+	bool ok = true;
+
+	auto flush = [&](size_t t) {
+		if (buffers[t].empty()) return;
+		ok = ok && seek(scratch, (first_row[t] + written[t]) * 3 * sizeof(Scalar));
+		ok = ok && fwrite(&buffers[t][0], sizeof(Scalar), buffers[t].size(), scratch) == buffers[t].size();
+		written[t] += buffers[t].size() / 3;
+		buffers[t].clear();
+	};
+
+	stream.rewind();
+	while (stream.next(chunk) && ok) {
+		for (int i=0; i<chunk.rows(); i++) {
+			double p[3] = {chunk(i, 0), chunk(i, 1), chunk(i, 2)};
+			int64_t c[3];
+			cell_of(p, origin, cell, c);
+			int t = tile_of_key[pack_cell(c)];
+
+			// Bounds of the points as the tile stores them
+			Scalar stored[3] = {(Scalar) p[0], (Scalar) p[1], (Scalar) p[2]};
+			bounds[t].extend(Eigen::Vector3d(stored[0], stored[1], stored[2]));
+			buffers[t].insert(buffers[t].end(), stored, stored + 3);
+			if (buffers[t].size() >= 3 * buffer_points) flush(t);
+		}
+	}
+	for (size_t t=0; t<T; t++) {
+		flush(t);
+	}
+	buffers.clear();
+
+	// One model index per tile
+	std::vector<Table_Record> records(T);
+	std::vector<Scalar> block;
+	for (size_t t=0; t<T && ok; t++) {
+		size_t rows = first_row[t + 1] - first_row[t];
+		block.resize(3 * rows);
+		ok = seek(scratch, first_row[t] * 3 * sizeof(Scalar)) &&
+		fread(&block[0], sizeof(Scalar), block.size(), scratch) == block.size();
+		if (!ok) break;
+
+		typename Tile::Point_Matrix verts;
+		resize_points(verts, rows);
+		for (size_t i=0; i<rows; i++) {
+			for (int d=0; d<3; d++) verts(i, d) = block[3*i + d];
+		}
+		ok = Tile(std::move(verts)).save(tile_path(directory, t));
+
+		Table_Record &record = records[t];
+		record.cell[0] = keys[t] >> 42;
+		record.cell[1] = (keys[t] >> 21) & (cells_per_axis - 1);
+		record.cell[2] = keys[t] & (cells_per_axis - 1);
+		record.rows = rows;
+		for (int d=0; d<3; d++) {
+			record.lower[d] = bounds[t].min()(d);
+			record.upper[d] = bounds[t].max()(d);
+		}
+	}
+	fclose(scratch);
+	remove(scratch_path.c_str());
+
+	if (!ok) {
+		std::cerr << "Could not write the tiles of " << points_path << " to " << directory << std::endl;
+		return false;
+	}
+
+	Table_Header header;
+	memcpy(header.magic, table_magic, sizeof(table_magic));
+	header.scalar_size = sizeof(Scalar);
+	header.layout = Layout;
+	header.num_tiles = T;
+	header.num_points = N;
+	header.cell = cell;
+	for (int d=0; d<3; d++) {
+		header.origin[d] = origin(d);
+		header.centroid[d] = sum(d) / N;
+	}
+
+	std::string path = directory + "/" + table_name;
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cerr << "Could not open " << path << " for writing" << std::endl;
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(&records[0], sizeof(Table_Record), T, file);
+	ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+template <typename Scalar, int Layout>
+std::shared_ptr<Basic_Tiled_Model_Index<Scalar, Layout> >
+Basic_Tiled_Model_Index<Scalar, Layout>::open(const std::string &directory, size_t max_resident_tiles) {
+
+	std::string path = directory + "/" + table_name;
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << "Could not read " << path << std::endl;
+		return std::shared_ptr<Basic_Tiled_Model_Index>();
+	}
+
+	Table_Header header;
+	std::vector<Table_Record> records;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+	memcmp(header.magic, table_magic, sizeof(table_magic)) == 0;
+	if (ok) {
+		records.resize(header.num_tiles);
+		ok = header.num_tiles == 0 ||
+		fread(&records[0], sizeof(Table_Record), records.size(), file) == records.size();
+	}
+	fclose(file);
+
+	if (!ok || header.num_tiles == 0) {
+		std::cerr << path << " is not a tile table" << std::endl;
+		return std::shared_ptr<Basic_Tiled_Model_Index>();
+	}
+	if (header.scalar_size != sizeof(Scalar) || header.layout != (uint32_t) Layout) {
+		std::cerr << path << " was saved with another scalar type or point layout" << std::endl;
+		return std::shared_ptr<Basic_Tiled_Model_Index>();
+	}
+
+	std::shared_ptr<Basic_Tiled_Model_Index> index(new Basic_Tiled_Model_Index());
+	index->directory = directory;
+	index->cell = header.cell;
+	index->total_points = header.num_points;
+	index->origin = Eigen::Vector3d(header.origin[0], header.origin[1], header.origin[2]);
+	index->model_centroid = Eigen::Vector3d(header.centroid[0], header.centroid[1], header.centroid[2]);
+	index->max_resident = std::max<size_t>(max_resident_tiles, 1);
+
+	index->tiles.resize(records.size());
+	for (size_t t=0; t<records.size(); t++) {
+		Tile_Record &tile = index->tiles[t];
+		tile.rows = records[t].rows;
+		tile.bounds = Eigen::AlignedBox3d(Eigen::Vector3d(records[t].lower),
+										  Eigen::Vector3d(records[t].upper));
+		for (int d=0; d<3; d++) tile.cell[d] = records[t].cell[d];
+		index->tile_of_cell[index->cell_key(tile.cell[0], tile.cell[1], tile.cell[2])] = (int) t;
+	}
+	return index;
+}
+
+template <typename Scalar, int Layout>
+uint64_t Basic_Tiled_Model_Index<Scalar, Layout>::cell_key(int64_t x, int64_t y, int64_t z) const {
+	return (uint64_t(x) << 42) | (uint64_t(y) << 21) | uint64_t(z);
+}
+
+template <typename Scalar, int Layout>
+std::shared_ptr<const typename Basic_Tiled_Model_Index<Scalar, Layout>::Tile>
+Basic_Tiled_Model_Index<Scalar, Layout>::tile(size_t i) const {
+
+	std::lock_guard<std::mutex> lock(cache_mutex);
+
+	for (auto it = resident.begin(); it != resident.end(); ++it) {
+		if (it->first == (int) i) {
+			resident.splice(resident.begin(), resident, it);
+			return it->second;
+		}
+	}
+
+	std::shared_ptr<const Tile> loaded = Tile::load(tile_path(directory, i));
+	if (!loaded) {
+		return loaded;
+	}
+	resident.push_front(std::make_pair((int) i, loaded));
+	if (resident.size() > max_resident) {
+		resident.pop_back();
+	}
+	return loaded;
+}
+
+/* Tiles are only let go of between searches, see find_nearest() */
+template <typename Scalar, int Layout>
+const typename Basic_Tiled_Model_Index<Scalar, Layout>::Tile *
+Basic_Tiled_Model_Index<Scalar, Layout>::cursor_tile(int i, Cursor &cursor) const {
+
+	for (size_t k=0; k<cursor.held.size(); k++) {
+		if (cursor.held[k].first == i) {
+			return cursor.held[k].second.get();
+		}
+	}
+
+	std::shared_ptr<const Tile> loaded = tile(i);
+	if (!loaded) {
+		return nullptr;
+	}
+	cursor.held.insert(cursor.held.begin(), std::make_pair(i, loaded));
+	return loaded.get();
+}
+
+/*
+ * The query's own cell and the ones around it are searched first. Every
+ * tile lies within its cell, so unless the nearest point found is further
+ * away than the cells beyond them, that is the answer; otherwise the other
+ * tiles are searched nearest bounds first, until the bounds lie further
+ * away than the nearest point found. The cursor holds at most
+ * 'cursor_tiles' of them at any time, the match's among them.
+ */
+
+template <typename Scalar, int Layout>
+bool Basic_Tiled_Model_Index<Scalar, Layout>::find_nearest(const Scalar *query, Cursor &cursor, Match &match) const {
+
+	// The last search's tiles may go now, bar the most recent ones
+	if (cursor.held.size() > cursor_tiles) {
+		cursor.held.resize(cursor_tiles);
+	}
+
+	match = Match();
+	Scalar best = std::numeric_limits<Scalar>::max();
+	Eigen::Vector3d q(query[0], query[1], query[2]);
+
+	auto search = [&](int t) {
+		if (tiles[t].bounds.squaredExteriorDistance(q) >= best) return;
+		const Tile *tile = cursor_tile(t, cursor);
+		if (!tile) return;
+
+		int index = -1;
+		Scalar distance;
+		nanoflann::KNNResultSet<Scalar, int> result_set(1);
+		result_set.init(&index, &distance);
+		distance = best;	// only nearer points are added
+		tile->tree().findNeighbors(result_set, query, nanoflann::SearchParams(10));
+
+		if (index >= 0) {
+			best = distance;
+			match.tile = tile;
+			match.tile_index = t;
+			match.index = index;
+			match.distance = distance;
+		}
+
+		// Let go of the oldest tiles, but not of the one the match is in
+		while (cursor.held.size() > cursor_tiles) {
+			size_t k = cursor.held.size() - 1;
+			if (cursor.held[k].first == match.tile_index) k--;
+			cursor.held.erase(cursor.held.begin() + k);
+		}
+	};
+
+	int64_t center[3];
+	double margin = 0.5;
+	for (int d=0; d<3; d++) {
+		double u = (query[d] - origin(d)) / cell;
+		double floor_u = std::floor(u);
+		center[d] = (int64_t) floor_u;
+		margin = std::min(margin, std::min(u - floor_u, 1 - (u - floor_u)));
+	}
+
+	auto tile_at = [&](int dx, int dy, int dz) {
+		int64_t x = center[0] + dx, y = center[1] + dy, z = center[2] + dz;
+		if (x < 0 || y < 0 || z < 0 || x >= cells_per_axis || y >= cells_per_axis || z >= cells_per_axis) {
+			return -1;
+		}
+		auto it = tile_of_cell.find(cell_key(x, y, z));
+		return it == tile_of_cell.end() ? -1 : it->second;
+	};
+
+	// Own cell first, then its neighbours
+	int home = tile_at(0, 0, 0);
+	if (home >= 0) search(home);
+	for (int dx=-1; dx<=1; dx++) {
+		for (int dy=-1; dy<=1; dy++) {
+			for (int dz=-1; dz<=1; dz++) {
+				int t = dx || dy || dz ? tile_at(dx, dy, dz) : -1;
+				if (t >= 0) search(t);
+			}
+		}
+	}
+
+	double bound = (1 + margin) * cell;
+	if (match.tile && best <= bound * bound) {
+		return true;
+	}
+
+	std::vector<std::pair<double, int> > others;
+	for (size_t t=0; t<tiles.size(); t++) {
+		const int64_t *c = tiles[t].cell;
+		bool searched = std::abs(c[0] - center[0]) <= 1 && std::abs(c[1] - center[1]) <= 1 &&
+		std::abs(c[2] - center[2]) <= 1;
+		if (!searched) others.push_back(std::make_pair(tiles[t].bounds.squaredExteriorDistance(q), (int) t));
+	}
+	std::sort(others.begin(), others.end());
+	for (size_t k=0; k<others.size() && others[k].first < best; k++) {
+		search(others[k].second);
+	}
+	return match.tile != nullptr;
+}
+
+#define INSTANTIATE_TILED_MODEL_INDEX(Scalar, Layout) \
+	template class Basic_Tiled_Model_Index<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_TILED_MODEL_INDEX)
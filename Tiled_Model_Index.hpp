@@ -0,0 +1,118 @@
+//
+//  Tiled_Model_Index.hpp
+//  icp_project
+//
+//
+
+#ifndef Tiled_Model_Index_hpp
+#define Tiled_Model_Index_hpp
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "Model_Index.hpp"
+
+/*
+ * A model too large for memory, cut into tiles along a uniform grid. Every
+ * tile is a Model_Index file of its own in a directory, next to a table of
+ * the tiles and their bounds, and only the tiles a search touches are
+ * mapped in. At most 'max_resident_tiles' stay mapped; the least recently
+ * used one is dropped when another is needed.
+ *
+ * Normals are fitted within each tile, as the model is read as points
+ * without faces.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Basic_Tiled_Model_Index {
+public:
+	typedef Basic_Model_Index<Scalar, Layout> Tile;
+	typedef Point_Cloud_Adaptor<Scalar, Layout> Points;
+
+	/*
+	 * Cuts the points in 'points_path' (any file Point_Stream reads) into
+	 * tiles of at most about 'tile_points' points and writes them to
+	 * 'directory', which is created if need be. The points are read a
+	 * chunk at a time, a few times over.
+	 */
+	static bool build(const std::string &points_path, const std::string &directory,
+					  size_t tile_points = 1 << 20, size_t chunk_size = 1 << 20);
+
+	/*
+	 * Returns an empty pointer if 'directory' holds no tiles, or tiles of
+	 * another scalar type or layout.
+	 */
+	static std::shared_ptr<Basic_Tiled_Model_Index> open(const std::string &directory,
+														size_t max_resident_tiles = 16);
+
+	Basic_Tiled_Model_Index(const Basic_Tiled_Model_Index &) = delete;
+	Basic_Tiled_Model_Index &operator=(const Basic_Tiled_Model_Index &) = delete;
+
+	size_t num_tiles() const { return tiles.size(); }
+	size_t num_points() const { return total_points; }
+
+	const Eigen::Vector3d &centroid() const { return model_centroid; }
+
+	const Eigen::AlignedBox3d &tile_bounds(size_t i) const { return tiles[i].bounds; }
+
+	/* Maps tile 'i' in, or returns it if it already is */
+	std::shared_ptr<const Tile> tile(size_t i) const;
+
+	/* Tiles one search thread holds on to, to skip the shared cache */
+	struct Cursor {
+		std::vector<std::pair<int, std::shared_ptr<const Tile> > > held;
+	};
+
+	/* A nearest model point: its tile, index in the tile and squared distance */
+	struct Match {
+		const Tile *tile = nullptr;
+		int tile_index = -1;
+		int index = -1;
+		Scalar distance = 0;
+	};
+
+	/*
+	 * Finds the model point nearest to 'query'. The tile in 'match' stays
+	 * valid until the next search with the same cursor. Returns false only
+	 * if no tile could be read.
+	 */
+	bool find_nearest(const Scalar *query, Cursor &cursor, Match &match) const;
+
+private:
+	struct Tile_Record {
+		Eigen::AlignedBox3d bounds;
+		size_t rows = 0;
+		int64_t cell[3];
+	};
+
+	Basic_Tiled_Model_Index() {}
+
+	static std::string tile_path(const std::string &directory, size_t i);
+
+	uint64_t cell_key(int64_t x, int64_t y, int64_t z) const;
+	const Tile *cursor_tile(int i, Cursor &cursor) const;
+
+	std::string directory;
+	std::vector<Tile_Record> tiles;
+	std::unordered_map<uint64_t, int> tile_of_cell;
+	Eigen::Vector3d origin, model_centroid;
+	double cell = 0;
+	size_t total_points = 0;
+
+	// Mapped tiles, most recently used first
+	size_t max_resident = 0;
+	mutable std::mutex cache_mutex;
+	mutable std::list<std::pair<int, std::shared_ptr<const Tile> > > resident;
+};
+
+typedef Basic_Tiled_Model_Index<double> Tiled_Model_Index;
+
+#endif /* Tiled_Model_Index_hpp */
@@ -0,0 +1,76 @@
+//
+//  Voxel_Grid.cpp
+//  icp_project
+//
+//
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Voxel_Grid.hpp"
+
+template <class Matrix>
+Matrix voxel_downsample(const Matrix &verts, double voxel_size) {
+	
+	const size_t N = verts.rows();
+	const Eigen::RowVector3d origin = verts.leftCols(3).colwise().minCoeff().template cast<double>();
+	
+	// Voxel coordinates packed into 21 bits each
+	std::unordered_map<uint64_t, size_t> voxel_to_row;
+	voxel_to_row.reserve(N);
+	
+	std::vector<size_t> row_of_vertex(N);
+	std::vector<size_t> count;
+	
+	for (size_t i=0; i<N; i++) {
+		uint64_t key = 0;
+		for (int d=0; d<3; d++) {
+			uint64_t cell = (uint64_t) std::floor((verts(i, d) - origin(d)) / voxel_size);
+			key = (key << 21) | (cell & 0x1FFFFF);
+		}
+		
+		std::unordered_map<uint64_t, size_t>::iterator it = voxel_to_row.find(key);
+		if (it == voxel_to_row.end()) {
+			it = voxel_to_row.insert(std::make_pair(key, count.size())).first;
+			count.push_back(0);
+		}
+		row_of_vertex[i] = it->second;
+		count[it->second]++;
+	}
+	
+	// Average the vertices of every voxel
+	Eigen::MatrixXd centroids = Eigen::MatrixXd::Zero(count.size(), 3);
+	for (size_t i=0; i<N; i++) {
+		centroids.row(row_of_vertex[i]) += verts.row(i).leftCols(3).template cast<double>();
+	}
+	for (size_t r=0; r<count.size(); r++) {
+		centroids.row(r) /= count[r];
+	}
+	
+	return to_points<Matrix>(centroids);
+}
+
+template <class Matrix>
+double estimate_point_spacing(const Matrix &verts) {
+	
+	if (verts.rows() < 2) {
+		return 0;
+	}
+	
+	// A surface patch of this extent sampled by N points
+	Eigen::RowVector3d extent = (verts.leftCols(3).colwise().maxCoeff()
+								 - verts.leftCols(3).colwise().minCoeff()).template cast<double>();
+	return extent.norm() / std::sqrt((double) verts.rows());
+}
+
+template Eigen::MatrixXd voxel_downsample(const Eigen::MatrixXd &, double);
+template double estimate_point_spacing(const Eigen::MatrixXd &);
+
+#define INSTANTIATE_VOXEL_GRID(Scalar, Layout) \
+	template Point_Storage<Scalar, Layout>::Matrix \
+	voxel_downsample(const Point_Storage<Scalar, Layout>::Matrix &, double); \
+	template double estimate_point_spacing(const Point_Storage<Scalar, Layout>::Matrix &);
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_VOXEL_GRID)
@@ -0,0 +1,33 @@
+//
+//  Voxel_Grid.hpp
+//  icp_project
+//
+//
+
+#ifndef Voxel_Grid_hpp
+#define Voxel_Grid_hpp
+
+#include <Eigen/Core>
+
+#include "Point_Storage.hpp"
+
+/*
+ * Replaces all vertices that fall into the same cube of side 'voxel_size'
+ * by their centroid. Returns one row per occupied voxel, in the same
+ * storage as 'verts'. Centroids are accumulated in double.
+ *
+ * Instantiated for Eigen::MatrixXd and every Point_Storage matrix.
+ */
+
+template <class Matrix>
+Matrix voxel_downsample(const Matrix &verts, double voxel_size);
+
+/*
+ * Rough distance between neighbouring vertices of a scanned surface,
+ * estimated from the bounding box and the vertex count.
+ */
+
+template <class Matrix>
+double estimate_point_spacing(const Matrix &verts);
+
+#endif /* Voxel_Grid_hpp */
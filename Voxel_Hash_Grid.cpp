@@ -0,0 +1,83 @@
+//
+//  Voxel_Hash_Grid.cpp
+//  icp_project
+//
+//
+
+#include <algorithm>
+
+#include "Voxel_Hash_Grid.hpp"
+
+template <typename Scalar, int Layout>
+Voxel_Hash_Grid<Scalar, Layout>::Voxel_Hash_Grid(const Points &points, double cell_size, int max_rings) :
+	max_rings(std::min(std::max(max_rings, 0), (int) max_supported_rings)) {
+
+	const size_t N = points.count;
+
+	origin = Eigen::Vector3d::Constant(MAXFLOAT);
+	Eigen::Vector3d upper = Eigen::Vector3d::Constant(-MAXFLOAT);
+	for (size_t i=0; i<N; i++) {
+		origin = origin.cwiseMin(points.point(i));
+		upper = upper.cwiseMax(points.point(i));
+	}
+
+	// The ring bound holds only if every point lies in its own cell, so
+	// cells grow until the extent fits into the 21 bit cell coordinates
+	double extent = N > 0 ? (upper - origin).maxCoeff() : 0;
+	cell = std::max(cell_size, extent / (cells_per_axis - 2));
+	inverse_cell = 1 / cell;
+
+	// Sort the point indices by cell, so every cell is one run
+	std::vector<std::pair<uint64_t, int> > keyed(N);
+	for (size_t i=0; i<N; i++) {
+		uint64_t key = 0;
+		for (int d=0; d<3; d++) {
+			int64_t c = (int64_t) std::floor((points.coeff(i, d) - origin(d)) * inverse_cell);
+			key = (key << 21) | (uint64_t) std::min(c, cells_per_axis - 1);
+		}
+		keyed[i] = std::make_pair(key, (int) i);
+	}
+	std::sort(keyed.begin(), keyed.end());
+
+	order.resize(N);
+	packed.resize(3 * N);
+	size_t num_cells = 0;
+	for (size_t k=0; k<N; k++) {
+		order[k] = keyed[k].second;
+		for (int d=0; d<3; d++) {
+			packed[3*k + d] = points.coeff(order[k], d);
+		}
+		num_cells += k == 0 || keyed[k].first != keyed[k-1].first;
+	}
+
+	// At most half full
+	shift = 63;
+	size_t size = 2;
+	while (size < 2 * num_cells) {
+		size *= 2;
+		shift--;
+	}
+	table.assign(size, Cell{empty_key, 0, 0});
+
+	const size_t mask = size - 1;
+	for (size_t begin=0; begin<N; ) {
+		size_t end = begin + 1;
+		while (end < N && keyed[end].first == keyed[begin].first) {
+			end++;
+		}
+
+		uint64_t key = keyed[begin].first;
+		size_t slot = (key * 0x9E3779B97F4A7C15ull) >> shift;
+		while (table[slot].key != empty_key) {
+			slot = (slot + 1) & mask;
+		}
+		table[slot] = Cell{key, (uint32_t) begin, (uint32_t) end};
+
+		begin = end;
+	}
+}
+
+#define INSTANTIATE_VOXEL_HASH_GRID(Scalar, Layout) \
+	template class Voxel_Hash_Grid<Scalar, Layout>;
+
+FOR_EACH_POINT_STORAGE(INSTANTIATE_VOXEL_HASH_GRID)
@@ -0,0 +1,155 @@
+//
+//  Voxel_Hash_Grid.hpp
+//  icp_project
+//
+//
+
+#ifndef Voxel_Hash_Grid_hpp
+#define Voxel_Hash_Grid_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "Point_Storage.hpp"
+
+/*
+ * Uniform grid of cubic cells over a point cloud, for nearest neighbour
+ * queries close to a densely sampled surface. Occupied cells are kept in
+ * an open addressing hash table and refer to a run of point indices, so
+ * a query costs a few table probes around its own cell instead of a walk
+ * down a tree.
+ *
+ * A query searches rings of cells around its own until the neighbours it
+ * has are provably the nearest, and gives up after 'max_rings' rings.
+ * Distances are squared Euclidean, as with the L2 kd-tree.
+ */
+
+template <typename Scalar, int Layout = row_major_padded>
+class Voxel_Hash_Grid {
+public:
+	typedef Point_Cloud_Adaptor<Scalar, Layout> Points;
+
+	/*
+	 * The points are copied in cell order, so the grid does not refer to
+	 * 'points' afterwards. At most 8 rings are searched. The cells are
+	 * made larger than 'cell_size' if the points span more than 2^21 of
+	 * them along some axis.
+	 */
+	Voxel_Hash_Grid(const Points &points, double cell_size, int max_rings = 2);
+
+	double cell_size() const { return cell; }
+
+	/*
+	 * Adds the points near 'query' to 'result_set', a nanoflann result
+	 * set. Returns true if it then holds the exact nearest neighbours,
+	 * and false if they may lie beyond the rings searched.
+	 */
+	template <class Result_Set>
+	bool find_neighbors(Result_Set &result_set, const Scalar *query) const;
+
+private:
+	struct Cell {
+		uint64_t key;
+		uint32_t begin, end;	// range of 'order'
+	};
+
+	static const uint64_t empty_key = ~uint64_t(0);
+	static const int64_t cells_per_axis = int64_t(1) << 21;
+	static const int max_supported_rings = 8;
+
+	const Cell *find_cell(int64_t x, int64_t y, int64_t z) const;
+
+	double cell;
+	double inverse_cell;
+	int max_rings;
+	Eigen::Vector3d origin;
+
+	std::vector<Cell> table;	// power of two size, linear probing
+	std::vector<int> order;		// point indices, grouped by cell
+	std::vector<Scalar> packed;	// x, y, z of the points in the same order
+	int shift;
+};
+
+template <typename Scalar, int Layout>
+inline const typename Voxel_Hash_Grid<Scalar, Layout>::Cell *
+Voxel_Hash_Grid<Scalar, Layout>::find_cell(int64_t x, int64_t y, int64_t z) const {
+
+	if (x < 0 || y < 0 || z < 0 || x >= cells_per_axis || y >= cells_per_axis || z >= cells_per_axis) {
+		return nullptr;
+	}
+	uint64_t key = (uint64_t(x) << 42) | (uint64_t(y) << 21) | uint64_t(z);
+	size_t mask = table.size() - 1;
+	for (size_t slot = (key * 0x9E3779B97F4A7C15ull) >> shift; ; slot = (slot + 1) & mask) {
+		const Cell &c = table[slot];
+		if (c.key == key) return &c;
+		if (c.key == empty_key) return nullptr;
+	}
+}
+
+template <typename Scalar, int Layout>
+template <class Result_Set>
+bool Voxel_Hash_Grid<Scalar, Layout>::find_neighbors(Result_Set &result_set, const Scalar *query) const {
+
+	// Cell of the query, and its squared distance along each axis to the
+	// cells at offsets -max_rings .. max_rings from it
+	const int R = max_rings;
+	int64_t center[3];
+	Scalar gap[3][2*max_supported_rings + 1];
+	double margin = 0.5;
+	for (int d=0; d<3; d++) {
+		double u = (query[d] - origin(d)) * inverse_cell;
+		double floor_u = std::floor(u);
+		double f = u - floor_u;
+		center[d] = (int64_t) floor_u;
+		margin = std::min(margin, std::min(f, 1 - f));
+
+		gap[d][R] = 0;
+		for (int o=1; o<=R; o++) {
+			Scalar above = (o - f) * cell, below = (o - 1 + f) * cell;
+			gap[d][R + o] = above * above;
+			gap[d][R - o] = below * below;
+		}
+	}
+
+	for (int r=0; r<=R; r++) {
+		for (int dx=-r; dx<=r; dx++) {
+			for (int dy=-r; dy<=r; dy++) {
+				// Inside the shell only the two caps along z are new
+				bool on_shell = dx == -r || dx == r || dy == -r || dy == r;
+				int step = on_shell || r == 0 ? 1 : 2 * r;
+
+				for (int dz=-r; dz<=r; dz+=step) {
+					// Skip cells that cannot hold anything nearer
+					Scalar box = gap[0][R + dx] + gap[1][R + dy] + gap[2][R + dz];
+					if (box >= result_set.worstDist()) continue;
+
+					const Cell *c = find_cell(center[0] + dx, center[1] + dy, center[2] + dz);
+					if (!c) continue;
+
+					for (uint32_t k=c->begin; k<c->end; k++) {
+						const Scalar *p = &packed[3*k];
+						Scalar dist = (query[0] - p[0]) * (query[0] - p[0])
+						+ (query[1] - p[1]) * (query[1] - p[1])
+						+ (query[2] - p[2]) * (query[2] - p[2]);
+						if (dist < result_set.worstDist()) {
+							result_set.addPoint(dist, order[k]);
+						}
+					}
+				}
+			}
+		}
+
+		// Cells outside ring r are at least this far away
+		double bound = (r + margin) * cell;
+		if (result_set.worstDist() <= bound * bound) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif /* Voxel_Hash_Grid_hpp */
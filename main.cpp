@@ -1,7 +1,6 @@
 #define LIBIGL_VIEWER_WITH_NANOGUI
 
 #include <igl/viewer/Viewer.h>
-#include <igl/readOBJ.h>
 #include <igl/writeOBJ.h>
 
 
@@ -12,7 +11,9 @@
 
 #include <string>
 
+#include "Async_Solver.hpp"
 #include "ICP_Solver.hpp"
+#include "Mesh_Loader.hpp"
 
 std::string MESH_DIRECTORY = "/Users/gudbrand/Documents/C++/ICP_Project/mesh/";
 
@@ -34,15 +35,24 @@ bool setup_icp_ui(igl::viewer::Viewer& viewer);
 
 void perform_icp();
 
+void pause_icp();
+
+void cancel_icp();
+
+bool show_icp_progress(igl::viewer::Viewer& viewer);
+
 void set_mesh();
 
-Mesh concat_meshes(Eigen::MatrixXd VA, Eigen::MatrixXi FA,
-				   Eigen::MatrixXd VB, Eigen::MatrixXi FB);
+Mesh concat_meshes(const Eigen::MatrixXd &VA, const Eigen::MatrixXi &FA,
+				   const Eigen::MatrixXd &VB, const Eigen::MatrixXi &FB);
 
 
 /* currently selected mesh */
 mesh_selection selected_mesh = diamond;
 
+/* objective minimized by the solver */
+ICP_Objective selected_objective = point_to_point;
+
 /* The libigl-viewer  */
 igl::viewer::Viewer viewer;
 
@@ -57,6 +67,9 @@ Eigen::MatrixXi data_faces;
 /* The concatinated mesh for viewing */
 Mesh concat_mesh;
 
+/* The alignment running in the background, if any */
+std::unique_ptr<Async_Solver> async_solver;
+
 /*
  * Initialize ui and and start the mainloop
  */
@@ -71,6 +84,7 @@ void init_viewer() {
 	viewer.data.set_face_based(true);
 	viewer.core.show_lines = false;
 	viewer.callback_init = setup_icp_ui;
+	viewer.callback_pre_draw = show_icp_progress;
 	viewer.launch();
 }
 
@@ -86,8 +100,13 @@ bool setup_icp_ui(igl::viewer::Viewer& viewer) {
 	viewer.ngui->addVariable("Select model", selected_mesh, true)
 	->setItems({"Moon", "Bunny", "Diamond", "Camel", "Camel2"});
 	
+	viewer.ngui->addVariable("Objective", selected_objective, true)
+	->setItems({"Point-to-point", "Point-to-plane"});
+	
 	// Add buttons and callbacks
 	viewer.ngui->addButton("Align", perform_icp);
+	viewer.ngui->addButton("Pause/Resume", pause_icp);
+	viewer.ngui->addButton("Cancel", cancel_icp);
 	viewer.ngui->addButton("Reset", load_mesh);
 
 	
@@ -98,21 +117,71 @@ bool setup_icp_ui(igl::viewer::Viewer& viewer) {
 
 /*
  * Callback for when the 'align' button is clicked
- * Uses an ICP_Solver object to align the meshes
+ * Starts an ICP_Solver on a background thread, show_icp_progress()
+ * moves the data mesh along as it goes
  */
 
 void perform_icp() {
 	
-	ICP_Solver solver = ICP_Solver(data_verts, model_verts);
-	solver.perform_icp();
+	if (async_solver && !async_solver->finished()) {
+		return;
+	}
 	
-	// show the aligned meshes in the viewer
-	concat_mesh.first.block(0, 0, data_verts.rows(), 3) = solver.data_verts;
-	set_mesh();
+	std::shared_ptr<ICP_Solver> solver = std::make_shared<ICP_Solver>(data_verts, model_verts, model_faces);
+	solver->objective = selected_objective;
+	
+	async_solver.reset(new Async_Solver(solver));
+	async_solver->start();
+	
+	// redraw every frame, not only on input, while the solver runs
+	viewer.core.is_animating = true;
+}
+
+void pause_icp() {
+	
+	if (!async_solver) {
+		return;
+	}
+	if (async_solver->is_paused()) {
+		async_solver->resume();
+	} else {
+		async_solver->pause();
+	}
+}
+
+void cancel_icp() {
 	
-	std::cout << "Final rotation\n" << solver.final_rotation << std::endl;
-	std::cout << "Final translation\n" << solver.final_translation << std::endl;
+	if (async_solver) {
+		async_solver->cancel();
+	}
+}
+
+/*
+ * Called before every frame: moves the data mesh to the latest pose the
+ * solver has posted. Only the vertex positions are sent to the viewer,
+ * the faces and colors stay as they are.
+ */
+
+bool show_icp_progress(igl::viewer::Viewer& viewer) {
 	
+	Pose_Update update;
+	if (!async_solver || !async_solver->poll(update)) {
+		return false;
+	}
+	
+	concat_mesh.first.topRows(data_verts.rows()) =
+	(data_verts * update.rotation.transpose()).rowwise() + update.translation.transpose();
+	viewer.data.set_vertices(concat_mesh.first);
+	viewer.data.compute_normals();
+	
+	if (update.finished) {
+		viewer.core.is_animating = false;
+		std::cout << (update.cancelled ? "Alignment cancelled" : "Alignment finished")
+		<< " after " << update.iteration << " iterations" << std::endl;
+		std::cout << "Final rotation\n" << update.rotation << std::endl;
+		std::cout << "Final translation\n" << update.translation << std::endl;
+	}
+	return false;
 }
 
 /*
@@ -120,6 +189,11 @@ void perform_icp() {
  */
 
 void load_mesh() {
+	
+	// stop any alignment of the old meshes first
+	async_solver.reset();
+	viewer.core.is_animating = false;
+	
 	std::string model_name;
 	std::string target_name;
 	
@@ -152,9 +226,9 @@ void load_mesh() {
 			break;
 	}
 	
-	// load obj-files
-	igl::readOBJ(MESH_DIRECTORY + target_name, model_verts, model_faces);
-	igl::readOBJ(MESH_DIRECTORY + model_name, data_verts, data_faces);
+	// load obj- or ply-files
+	read_mesh(MESH_DIRECTORY + target_name, model_verts, model_faces);
+	read_mesh(MESH_DIRECTORY + model_name, data_verts, data_faces);
 	
 	// update the viewed mesh
 	concat_mesh = concat_meshes(data_verts, data_faces, model_verts, model_faces);
@@ -177,8 +251,8 @@ void set_mesh() {
 	viewer.data.set_colors(C);
 }
 
-Mesh concat_meshes(Eigen::MatrixXd VA, Eigen::MatrixXi FA,
-				   Eigen::MatrixXd VB, Eigen::MatrixXi FB) {
+Mesh concat_meshes(const Eigen::MatrixXd &VA, const Eigen::MatrixXi &FA,
+				   const Eigen::MatrixXd &VB, const Eigen::MatrixXi &FB) {
 	
 	
 	//Found this way of concatenating meshes in the libigl github comments
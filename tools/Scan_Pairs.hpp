@@ -0,0 +1,34 @@
+//
+//  Scan_Pairs.hpp
+//  icp_project
+//
+//
+
+#ifndef Scan_Pairs_hpp
+#define Scan_Pairs_hpp
+
+#include <cstddef>
+
+/*
+ * Pairs of real views of the same object from the mesh/ corpus, shared by
+ * icp_bench and icp_tune. The data file is registered onto the model file.
+ */
+
+struct Scan_Pair {
+	const char *name;
+	const char *data_file;
+	const char *model_file;
+};
+
+static const Scan_Pair scan_pairs[] = {
+	{"camel_noisy_translated", "noisy_translated_camel.obj", "camel.obj"},
+	{"camel_headless", "camel_headless.obj", "camel.obj"},
+	{"camel_truncated", "noisy_translated_camel_trunc.obj", "camel.obj"},
+	{"bunny_045_000", "bun045.ply", "bun000.ply"},
+	{"bunny_045_315", "bun045_init_align_to_315__.ply", "bun315.ply"},
+	{"top_2_3", "top2.ply", "top3.ply"},
+};
+
+static const size_t num_scan_pairs = sizeof(scan_pairs) / sizeof(scan_pairs[0]);
+
+#endif /* Scan_Pairs_hpp */
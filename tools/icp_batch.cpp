@@ -0,0 +1,358 @@
+//
+//  icp_batch.cpp
+//  icp_project
+//
+//  Headless registration of many (data, model) mesh pairs.
+//
+//  Usage: icp_batch <manifest> [-o results.csv|results.json]
+//                   [-j workers] [--max-meshes N] [--levels L]
+//                   [--objective point|plane]
+//
+//  Every non-empty line of the manifest that does not start with '#'
+//  names a data mesh and a model mesh, separated by whitespace. Relative
+//  paths are taken relative to the manifest. A model given as a .icpidx
+//  file written by icp_index is mapped instead of being rebuilt.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ICP_Solver.hpp"
+#include "Job_Scheduler.hpp"
+#include "Mesh_Loader.hpp"
+
+struct Pair_Result {
+	std::string data_path;
+	std::string model_path;
+	bool loaded = false;
+	bool converged = false;
+	int iterations = 0;
+	double error = 0;
+	double seconds = 0;
+	Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+};
+
+struct Batch_Options {
+	std::string manifest;
+	std::string output;
+	size_t num_workers = 0;
+	size_t max_meshes = 0;
+	size_t num_levels = 1;
+	ICP_Objective objective = point_to_point;
+};
+
+void print_usage() {
+	std::cerr << "Usage: icp_batch <manifest> [-o results.csv|results.json]"
+	<< " [-j workers] [--max-meshes N] [--levels L]"
+	<< " [--objective point|plane]" << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Batch_Options &options) {
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-o" && has_value) {
+			options.output = argv[++i];
+		} else if (arg == "-j" && has_value) {
+			options.num_workers = std::stoul(argv[++i]);
+		} else if (arg == "--max-meshes" && has_value) {
+			options.max_meshes = std::stoul(argv[++i]);
+		} else if (arg == "--levels" && has_value) {
+			options.num_levels = std::stoul(argv[++i]);
+		} else if (arg == "--objective" && has_value) {
+			std::string objective = argv[++i];
+			if (objective == "point") {
+				options.objective = point_to_point;
+			} else if (objective == "plane") {
+				options.objective = point_to_plane;
+			} else {
+				return false;
+			}
+		} else if (options.manifest.empty() && arg[0] != '-') {
+			options.manifest = arg;
+		} else {
+			return false;
+		}
+	}
+
+	return !options.manifest.empty();
+}
+
+std::string directory_of(const std::string &path) {
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+bool read_manifest(const std::string &manifest, std::vector<Pair_Result> &pairs) {
+
+	std::ifstream in(manifest);
+	if (!in) {
+		return false;
+	}
+
+	std::string base = directory_of(manifest);
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		Pair_Result pair;
+		if (!(fields >> pair.data_path) || pair.data_path[0] == '#') {
+			continue;
+		}
+		if (!(fields >> pair.model_path)) {
+			std::cerr << "Skipping incomplete manifest line: " << line << std::endl;
+			continue;
+		}
+		if (pair.data_path[0] != '/') pair.data_path = base + pair.data_path;
+		if (pair.model_path[0] != '/') pair.model_path = base + pair.model_path;
+		pairs.push_back(pair);
+	}
+
+	return true;
+}
+
+/*
+ * Model indices by path, built or mapped by whichever job needs them
+ * first and shared by every job registering against that model at the
+ * same time. An index takes one mesh slot of its own for as long as any
+ * job uses it: every job comes with two slots, the first job of a model
+ * leaves its second one to the index and the others hand theirs back.
+ * The last job to let go of an index frees it and its slot.
+ */
+
+class Model_Cache {
+public:
+	Model_Cache(size_t num_levels, Counting_Semaphore &mesh_slots) :
+		num_levels(num_levels), mesh_slots(mesh_slots) {}
+
+	/* For a job holding two mesh slots, one of which it may lose to the index */
+	std::shared_ptr<const Model_Index> get(const std::string &path) {
+		Entry &entry = find(path);
+		std::lock_guard<std::mutex> lock(entry.mutex);
+		if (entry.users++ > 0) {
+			mesh_slots.release(1);
+			return entry.index;
+		}
+		entry.index = build(path);
+		return entry.index;
+	}
+
+	/* The job is done with the index of 'path' */
+	void release(const std::string &path) {
+		Entry &entry = find(path);
+		std::shared_ptr<const Model_Index> last;
+		{
+			std::lock_guard<std::mutex> lock(entry.mutex);
+			if (--entry.users > 0) {
+				return;
+			}
+			last.swap(entry.index);
+		}
+		// Destroyed outside the lock, before its slot is given back
+		last.reset();
+		mesh_slots.release(1);
+	}
+
+private:
+	struct Entry {
+		std::mutex mutex;
+		std::shared_ptr<const Model_Index> index;
+		size_t users = 0;
+	};
+
+	Entry &find(const std::string &path) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries[path];
+	}
+
+	std::shared_ptr<const Model_Index> build(const std::string &path) {
+		const std::string suffix = ".icpidx";
+		if (path.size() > suffix.size() &&
+			path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+			return Model_Index::load(path);
+		}
+
+		Model_Index::Point_Matrix verts;
+		Eigen::MatrixXi faces;
+		if (!read_mesh(path, verts, faces, 1) || verts.rows() == 0) {
+			return std::shared_ptr<const Model_Index>();
+		}
+		return std::make_shared<Model_Index>(std::move(verts), faces, num_levels);
+	}
+
+	size_t num_levels;
+	Counting_Semaphore &mesh_slots;
+	std::mutex mutex;
+	std::map<std::string, Entry> entries;
+};
+
+void register_pair(Pair_Result &result, Model_Cache &models, ICP_Objective objective) {
+
+	ICP_Solver::Point_Matrix data_verts;
+
+	std::shared_ptr<const Model_Index> model_index = models.get(result.model_path);
+	if (!model_index ||
+		!read_points(result.data_path, data_verts, 1) ||
+		data_verts.rows() == 0) {
+		return;
+	}
+	result.loaded = true;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Parallelism comes from running many pairs at once
+	ICP_Solver solver(std::move(data_verts), *model_index);
+	solver.verbose = false;
+	solver.num_threads = 1;
+	solver.objective = objective;
+	result.converged = solver.perform_icp();
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.iterations = solver.get_iterations();
+	result.error = solver.get_error();
+	result.rotation = solver.final_rotation;
+	result.translation = solver.final_translation;
+}
+
+std::string json_string(const std::string &s) {
+	std::string out = "\"";
+	for (size_t i=0; i<s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\') out += '\\';
+		out += s[i];
+	}
+	return out + "\"";
+}
+
+void write_csv(std::ostream &out, const std::vector<Pair_Result> &results) {
+
+	out << "data,model,loaded,converged,iterations,error,seconds,"
+	<< "r00,r01,r02,r10,r11,r12,r20,r21,r22,tx,ty,tz\n";
+	out.precision(17);
+
+	for (size_t i=0; i<results.size(); i++) {
+		const Pair_Result &r = results[i];
+		out << r.data_path << "," << r.model_path << "," << r.loaded << ","
+		<< r.converged << "," << r.iterations << "," << r.error << "," << r.seconds;
+		for (int a=0; a<3; a++) {
+			for (int b=0; b<3; b++) {
+				out << "," << r.rotation(a, b);
+			}
+		}
+		for (int a=0; a<3; a++) {
+			out << "," << r.translation(a);
+		}
+		out << "\n";
+	}
+}
+
+void write_json(std::ostream &out, const std::vector<Pair_Result> &results) {
+
+	out.precision(17);
+	out << "[\n";
+
+	for (size_t i=0; i<results.size(); i++) {
+		const Pair_Result &r = results[i];
+		out << "  {\"data\": " << json_string(r.data_path)
+		<< ", \"model\": " << json_string(r.model_path)
+		<< ", \"loaded\": " << (r.loaded ? "true" : "false")
+		<< ", \"converged\": " << (r.converged ? "true" : "false")
+		<< ", \"iterations\": " << r.iterations
+		<< ", \"error\": " << r.error
+		<< ", \"seconds\": " << r.seconds
+		<< ", \"rotation\": [";
+		for (int a=0; a<3; a++) {
+			out << (a ? ", " : "") << "[" << r.rotation(a, 0) << ", "
+			<< r.rotation(a, 1) << ", " << r.rotation(a, 2) << "]";
+		}
+		out << "], \"translation\": [" << r.translation(0) << ", "
+		<< r.translation(1) << ", " << r.translation(2) << "]}"
+		<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	out << "]\n";
+}
+
+int main(int argc, char *argv[]) {
+
+	Batch_Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 1;
+	}
+
+	std::vector<Pair_Result> results;
+	if (!read_manifest(options.manifest, results)) {
+		std::cerr << "Could not read manifest " << options.manifest << std::endl;
+		return 1;
+	}
+
+	Job_Scheduler scheduler(options.num_workers);
+
+	// Every running job holds its data mesh, and every model index in use
+	// is held once. Jobs take both of their slots at once, so none waits
+	// for a slot while holding one.
+	size_t max_meshes = options.max_meshes ? options.max_meshes : 2 * scheduler.size();
+	Counting_Semaphore mesh_slots(std::max<size_t>(max_meshes, 2));
+	Model_Cache models(options.num_levels, mesh_slots);
+
+	// Pairs against one model are submitted together, so they tend to run
+	// at the same time and share its index instead of building it again
+	std::vector<size_t> order(results.size());
+	for (size_t i=0; i<results.size(); i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&results](size_t a, size_t b) {
+		return results[a].model_path < results[b].model_path;
+	});
+
+	std::mutex log_mutex;
+	for (size_t i=0; i<order.size(); i++) {
+		Pair_Result &result = results[order[i]];
+		scheduler.submit([&result, &mesh_slots, &models, &log_mutex, &options] {
+			mesh_slots.acquire(2);
+			register_pair(result, models, options.objective);
+			models.release(result.model_path);
+			mesh_slots.release(1);
+
+			std::lock_guard<std::mutex> lock(log_mutex);
+			if (result.loaded) {
+				std::cerr << result.data_path << " -> " << result.model_path
+				<< ": error " << result.error << " after " << result.iterations
+				<< " iterations" << std::endl;
+			} else {
+				std::cerr << "Could not load " << result.data_path
+				<< " or " << result.model_path << std::endl;
+			}
+		});
+	}
+	scheduler.wait();
+
+	// Results in manifest order, to a file or to stdout
+	std::ofstream file;
+	if (!options.output.empty()) {
+		file.open(options.output);
+		if (!file) {
+			std::cerr << "Could not write " << options.output << std::endl;
+			return 1;
+		}
+	}
+	std::ostream &out = options.output.empty() ? std::cout : file;
+
+	const std::string &o = options.output;
+	if (o.size() >= 5 && o.compare(o.size() - 5, 5, ".json") == 0) {
+		write_json(out, results);
+	} else {
+		write_csv(out, results);
+	}
+
+	return 0;
+}
@@ -0,0 +1,494 @@
+//
+//  icp_bench.cpp
+//  icp_project
+//
+//  Benchmark of ICP_Solver over fixed pairs from the mesh/ corpus.
+//
+//  Usage: icp_bench [-o results.json|results.csv] [--mesh-dir DIR]
+//                   [--repeat N] [--threads T] [--levels L] [--filter TEXT]
+//                   [--float] [--kernel huber|tukey|cauchy|geman-mcclure]
+//                   [--overlap F] [--full-search]
+//                   [--search exact|approximate|grid] [--epsilon E]
+//                   [--global-init]
+//
+//  Synthetic cases move a corpus mesh by a known rigid transform (and
+//  optionally add noise to it) and register it back onto the original, so
+//  the result can be compared against the ground truth vertex by vertex.
+//  Scan pairs register two real views of the same object and only report
+//  the solver's own error. bun000_far is bun000_rigid with both clouds
+//  moved 1e5 units away from the origin, as georeferenced scans are.
+//  Every case runs with both objectives, each in a child process of its
+//  own so its peak memory can be told apart.
+//
+//  Phase timings are the best of --repeat runs, in milliseconds. --float
+//  runs the single precision solver instead of the double precision one.
+//  --kernel and --overlap select a robust kernel and trimmed ICP instead of
+//  the default 1.5 sigma rejection. --full-search turns off the incremental
+//  correspondence search. --search picks the nearest neighbour backend,
+//  --epsilon the error bound of the approximate one. --global-init runs the
+//  global initialization first; its time counts towards the total.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "ICP_Solver.hpp"
+#include "Mesh_Loader.hpp"
+#include "Scan_Pairs.hpp"
+
+#ifndef ICP_BENCH_MESH_DIR
+#define ICP_BENCH_MESH_DIR "mesh"
+#endif
+
+struct Bench_Case {
+	std::string name;
+	std::string data_file;		// empty for synthetic cases
+	std::string model_file;
+	double angle = 0;			// degrees, about a fixed oblique axis
+	double offset = 0;			// fraction of the bounding box diagonal
+	double noise = 0;			// fraction of the bounding box diagonal
+	double shift = 0;			// added to every coordinate of both clouds
+};
+
+/* Plain data, so a child process can send it back through a pipe */
+struct Case_Result {
+	bool loaded = false;
+	bool converged = false;
+	bool has_ground_truth = false;
+	int iterations = 0;
+	long data_rows = 0;
+	long model_rows = 0;
+	double error = 0;
+	double rotation_error = 0;		// degrees
+	double translation_error = 0;	// model units
+	double vertex_rms = 0;			// model units
+	double tree_build_ms = 0;
+	double correspondence_ms = 0;
+	double rejection_ms = 0;
+	double registration_ms = 0;
+	double error_ms = 0;
+	double total_ms = 0;
+	long peak_rss_kb = 0;
+};
+
+struct Bench_Options {
+	std::string output;
+	std::string mesh_dir = ICP_BENCH_MESH_DIR;
+	std::string filter;
+	size_t repeat = 3;
+	size_t num_threads = 0;
+	size_t num_levels = 1;
+	bool single_precision = false;
+	Robust_Kernel robust_kernel = sigma_rejection;
+	double overlap_ratio = 1;
+	bool incremental_search = true;
+	Search_Backend search_backend = exact_kd_tree;
+	double search_epsilon = 2;
+	bool global_initialization = false;
+};
+
+std::vector<Bench_Case> bench_cases() {
+
+	std::vector<Bench_Case> cases;
+	const char *synthetic[] = {"camel.obj", "bun000.ply", "chin.ply", "ear_back.ply", "top2.ply"};
+
+	for (size_t i=0; i<sizeof(synthetic)/sizeof(synthetic[0]); i++) {
+		std::string file = synthetic[i];
+		std::string stem = file.substr(0, file.find('.'));
+
+		Bench_Case clean;
+		clean.name = stem + "_rigid";
+		clean.model_file = file;
+		clean.angle = 10;
+		clean.offset = 0.05;
+		cases.push_back(clean);
+
+		Bench_Case noisy = clean;
+		noisy.name = stem + "_noisy";
+		noisy.noise = 0.002;
+		cases.push_back(noisy);
+	}
+
+	Bench_Case far;
+	far.name = "bun000_far";
+	far.model_file = "bun000.ply";
+	far.angle = 10;
+	far.offset = 0.05;
+	far.shift = 1e5;
+	cases.push_back(far);
+
+	for (size_t i=0; i<num_scan_pairs; i++) {
+		Bench_Case scan;
+		scan.name = scan_pairs[i].name;
+		scan.data_file = scan_pairs[i].data_file;
+		scan.model_file = scan_pairs[i].model_file;
+		cases.push_back(scan);
+	}
+
+	return cases;
+}
+
+double milliseconds(uint64_t ns) {
+	return ns * 1e-6;
+}
+
+/* Ground truth motion of a synthetic case, p -> R (p - c) + c + t */
+void ground_truth(const Bench_Case &bench_case, const Eigen::MatrixXd &model_verts,
+				  Eigen::Matrix3d &R, Eigen::Vector3d &t, Eigen::Vector3d &c, double &diagonal) {
+
+	Eigen::RowVector3d lo = model_verts.colwise().minCoeff();
+	Eigen::RowVector3d hi = model_verts.colwise().maxCoeff();
+	diagonal = (hi - lo).norm();
+	c = model_verts.colwise().mean().transpose();
+
+	Eigen::Vector3d axis(1, 2, 3);
+	R = Eigen::AngleAxisd(bench_case.angle * M_PI / 180, axis.normalized()).toRotationMatrix();
+	t = Eigen::Vector3d(1, -1, 1).normalized() * bench_case.offset * diagonal;
+}
+
+/* Runs the solver --repeat times and keeps the fastest run in 'result' */
+template <class Solver>
+void run_solver(const Eigen::MatrixXd &data_verts, const Eigen::MatrixXd &model_verts,
+				const Eigen::MatrixXi &model_faces, const Eigen::Matrix3d &R_true,
+				ICP_Objective objective, const Bench_Options &options, Case_Result &result) {
+
+	for (size_t r=0; r<std::max<size_t>(options.repeat, 1); r++) {
+		Solver solver(data_verts, model_verts, model_faces);
+		solver.verbose = false;
+		solver.num_threads = options.num_threads;
+		solver.num_levels = options.num_levels;
+		solver.objective = objective;
+		solver.robust_kernel = options.robust_kernel;
+		solver.overlap_ratio = options.overlap_ratio;
+		solver.incremental_search = options.incremental_search;
+		solver.search_backend = options.search_backend;
+		solver.search_epsilon = options.search_epsilon;
+		solver.global_initialization = options.global_initialization;
+		result.converged = solver.perform_icp();
+
+		const Phase_Timings &timings = solver.get_timings();
+		bool best = r == 0 || milliseconds(timings.total()) < result.total_ms;
+		if (!best) {
+			continue;
+		}
+
+		result.tree_build_ms = milliseconds(timings.tree_build);
+		result.correspondence_ms = milliseconds(timings.correspondence);
+		result.rejection_ms = milliseconds(timings.rejection);
+		result.registration_ms = milliseconds(timings.registration);
+		result.error_ms = milliseconds(timings.error);
+		result.total_ms = milliseconds(timings.total());
+		result.iterations = solver.get_iterations();
+		result.error = solver.get_error();
+
+		if (result.has_ground_truth) {
+			// The recovered rotation should undo the applied one
+			Eigen::AngleAxisd residual(solver.final_rotation * R_true);
+			result.rotation_error = std::abs(residual.angle()) * 180 / M_PI;
+
+			// Vertex i of the data came from vertex i of the model
+			Eigen::MatrixXd moved = solver.transformed_data().leftCols(3).template cast<double>();
+			Eigen::VectorXd offsets = (moved - model_verts).rowwise().norm();
+			result.vertex_rms = std::sqrt(offsets.squaredNorm() / offsets.size());
+			result.translation_error = (moved.colwise().mean()
+										- model_verts.colwise().mean()).norm();
+		}
+	}
+}
+
+Case_Result run_case(const Bench_Case &bench_case, ICP_Objective objective,
+					 const Bench_Options &options) {
+
+	Case_Result result;
+	Eigen::MatrixXd model_verts, data_verts;
+	Eigen::MatrixXi model_faces;
+
+	std::string model_path = options.mesh_dir + "/" + bench_case.model_file;
+	if (!read_mesh(model_path, model_verts, model_faces) || model_verts.rows() == 0) {
+		return result;
+	}
+
+	model_verts.array() += bench_case.shift;
+
+	Eigen::Matrix3d R_true = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d t_true = Eigen::Vector3d::Zero();
+	Eigen::Vector3d center = Eigen::Vector3d::Zero();
+
+	if (bench_case.data_file.empty()) {
+		double diagonal;
+		ground_truth(bench_case, model_verts, R_true, t_true, center, diagonal);
+
+		data_verts = (model_verts.rowwise() - center.transpose()) * R_true.transpose();
+		data_verts.rowwise() += (center + t_true).transpose();
+
+		if (bench_case.noise > 0) {
+			std::mt19937 rng(42);
+			std::normal_distribution<double> gauss(0, bench_case.noise * diagonal);
+			for (long i=0; i<data_verts.size(); i++) {
+				data_verts.data()[i] += gauss(rng);
+			}
+		}
+		result.has_ground_truth = true;
+	} else {
+		std::string data_path = options.mesh_dir + "/" + bench_case.data_file;
+		if (!read_points(data_path, data_verts) || data_verts.rows() == 0) {
+			return result;
+		}
+		data_verts.array() += bench_case.shift;
+	}
+
+	result.loaded = true;
+	result.data_rows = data_verts.rows();
+	result.model_rows = model_verts.rows();
+
+	if (options.single_precision) {
+		run_solver<ICP_Solver_f>(data_verts, model_verts, model_faces, R_true, objective,
+								 options, result);
+	} else {
+		run_solver<ICP_Solver>(data_verts, model_verts, model_faces, R_true, objective,
+							   options, result);
+	}
+
+	return result;
+}
+
+/*
+ * Runs the case in a child process and reads its result back, so the
+ * peak resident size belongs to this case alone. Runs in-process where
+ * there is no fork(), without a memory figure.
+ */
+
+Case_Result run_isolated(const Bench_Case &bench_case, ICP_Objective objective,
+						 const Bench_Options &options) {
+
+#ifdef _WIN32
+	return run_case(bench_case, objective, options);
+#else
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return run_case(bench_case, objective, options);
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return run_case(bench_case, objective, options);
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		Case_Result result = run_case(bench_case, objective, options);
+		ssize_t written = write(fds[1], &result, sizeof(result));
+		close(fds[1]);
+		_exit(written == (ssize_t) sizeof(result) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	Case_Result result;
+	ssize_t got = read(fds[0], &result, sizeof(result));
+	close(fds[0]);
+
+	int status = 0;
+	struct rusage usage;
+	wait4(pid, &status, 0, &usage);
+
+	if (got != (ssize_t) sizeof(result)) {
+		return Case_Result();
+	}
+
+	// Kilobytes on Linux, bytes on macOS
+#ifdef __APPLE__
+	result.peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+	result.peak_rss_kb = usage.ru_maxrss;
+#endif
+	return result;
+#endif
+}
+
+void print_usage() {
+	std::cerr << "Usage: icp_bench [-o results.json|results.csv] [--mesh-dir DIR]"
+	<< " [--repeat N] [--threads T] [--levels L] [--filter TEXT] [--float]"
+	<< " [--kernel huber|tukey|cauchy|geman-mcclure] [--overlap F]"
+	<< " [--full-search] [--search exact|approximate|grid] [--epsilon E]"
+	<< " [--global-init]" << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Bench_Options &options) {
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-o" && has_value) {
+			options.output = argv[++i];
+		} else if (arg == "--mesh-dir" && has_value) {
+			options.mesh_dir = argv[++i];
+		} else if (arg == "--repeat" && has_value) {
+			options.repeat = std::stoul(argv[++i]);
+		} else if (arg == "--threads" && has_value) {
+			options.num_threads = std::stoul(argv[++i]);
+		} else if (arg == "--levels" && has_value) {
+			options.num_levels = std::stoul(argv[++i]);
+		} else if (arg == "--filter" && has_value) {
+			options.filter = argv[++i];
+		} else if (arg == "--float") {
+			options.single_precision = true;
+		} else if (arg == "--full-search") {
+			options.incremental_search = false;
+		} else if (arg == "--global-init") {
+			options.global_initialization = true;
+		} else if (arg == "--overlap" && has_value) {
+			options.overlap_ratio = std::stod(argv[++i]);
+		} else if (arg == "--epsilon" && has_value) {
+			options.search_epsilon = std::stod(argv[++i]);
+		} else if (arg == "--search" && has_value) {
+			std::string name = argv[++i];
+			if (name == "exact") options.search_backend = exact_kd_tree;
+			else if (name == "approximate") options.search_backend = approximate_kd_tree;
+			else if (name == "grid") options.search_backend = voxel_hash_grid;
+			else return false;
+		} else if (arg == "--kernel" && has_value) {
+			std::string name = argv[++i];
+			if (name == "huber") options.robust_kernel = huber_kernel;
+			else if (name == "tukey") options.robust_kernel = tukey_kernel;
+			else if (name == "cauchy") options.robust_kernel = cauchy_kernel;
+			else if (name == "geman-mcclure") options.robust_kernel = geman_mcclure_kernel;
+			else return false;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct Bench_Row {
+	std::string name;
+	std::string objective;
+	Case_Result result;
+};
+
+void write_csv(std::ostream &out, const std::vector<Bench_Row> &rows) {
+
+	out << "case,objective,loaded,converged,iterations,data_rows,model_rows,error,"
+	<< "rotation_error_deg,translation_error,vertex_rms,tree_build_ms,correspondence_ms,"
+	<< "rejection_ms,registration_ms,error_ms,total_ms,peak_rss_kb\n";
+	out.precision(9);
+
+	for (size_t i=0; i<rows.size(); i++) {
+		const Case_Result &r = rows[i].result;
+		out << rows[i].name << "," << rows[i].objective << "," << r.loaded << ","
+		<< r.converged << "," << r.iterations << "," << r.data_rows << "," << r.model_rows
+		<< "," << r.error << ",";
+		if (r.has_ground_truth) {
+			out << r.rotation_error << "," << r.translation_error << "," << r.vertex_rms;
+		} else {
+			out << ",,";
+		}
+		out << "," << r.tree_build_ms << "," << r.correspondence_ms << "," << r.rejection_ms
+		<< "," << r.registration_ms << "," << r.error_ms << "," << r.total_ms
+		<< "," << r.peak_rss_kb << "\n";
+	}
+}
+
+void write_json(std::ostream &out, const std::vector<Bench_Row> &rows) {
+
+	out.precision(9);
+	out << "[\n";
+
+	for (size_t i=0; i<rows.size(); i++) {
+		const Case_Result &r = rows[i].result;
+		out << "  {\"case\": \"" << rows[i].name << "\""
+		<< ", \"objective\": \"" << rows[i].objective << "\""
+		<< ", \"loaded\": " << (r.loaded ? "true" : "false")
+		<< ", \"converged\": " << (r.converged ? "true" : "false")
+		<< ", \"iterations\": " << r.iterations
+		<< ", \"data_rows\": " << r.data_rows
+		<< ", \"model_rows\": " << r.model_rows
+		<< ", \"error\": " << r.error;
+		if (r.has_ground_truth) {
+			out << ", \"rotation_error_deg\": " << r.rotation_error
+			<< ", \"translation_error\": " << r.translation_error
+			<< ", \"vertex_rms\": " << r.vertex_rms;
+		}
+		out << ", \"ms\": {\"tree_build\": " << r.tree_build_ms
+		<< ", \"correspondence\": " << r.correspondence_ms
+		<< ", \"rejection\": " << r.rejection_ms
+		<< ", \"registration\": " << r.registration_ms
+		<< ", \"error\": " << r.error_ms
+		<< ", \"total\": " << r.total_ms << "}"
+		<< ", \"peak_rss_kb\": " << r.peak_rss_kb << "}"
+		<< (i + 1 < rows.size() ? "," : "") << "\n";
+	}
+
+	out << "]\n";
+}
+
+int main(int argc, char *argv[]) {
+
+	Bench_Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 1;
+	}
+
+	std::vector<Bench_Case> cases = bench_cases();
+	const ICP_Objective objectives[] = {point_to_point, point_to_plane};
+	const char *objective_names[] = {"point", "plane"};
+
+	std::vector<Bench_Row> rows;
+	for (size_t i=0; i<cases.size(); i++) {
+		if (!options.filter.empty() && cases[i].name.find(options.filter) == std::string::npos) {
+			continue;
+		}
+
+		for (int o=0; o<2; o++) {
+			Bench_Row row;
+			row.name = cases[i].name;
+			row.objective = objective_names[o];
+			row.result = run_isolated(cases[i], objectives[o], options);
+			rows.push_back(row);
+
+			const Case_Result &r = row.result;
+			if (r.loaded) {
+				std::cerr << row.name << " (" << row.objective << "): " << r.total_ms
+				<< " ms, " << r.iterations << " iterations, error " << r.error << std::endl;
+			} else {
+				std::cerr << row.name << " (" << row.objective << "): could not load" << std::endl;
+			}
+		}
+	}
+
+	std::ofstream file;
+	if (!options.output.empty()) {
+		file.open(options.output);
+		if (!file) {
+			std::cerr << "Could not write " << options.output << std::endl;
+			return 1;
+		}
+	}
+	std::ostream &out = options.output.empty() ? std::cout : file;
+
+	const std::string &o = options.output;
+	if (o.size() >= 4 && o.compare(o.size() - 4, 4, ".csv") == 0) {
+		write_csv(out, rows);
+	} else {
+		write_json(out, rows);
+	}
+
+	return 0;
+}
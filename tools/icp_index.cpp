@@ -0,0 +1,39 @@
+//
+//  icp_index.cpp
+//  icp_project
+//
+//  Builds the kd-tree index of a model mesh once and writes it to disk,
+//  so later registrations can map it instead of rebuilding it.
+//
+//  Usage: icp_index <model mesh> <output.icpidx> [--levels L]
+//
+
+#include <iostream>
+#include <string>
+
+#include "Mesh_Loader.hpp"
+#include "Model_Index.hpp"
+
+int main(int argc, char *argv[]) {
+
+	if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--levels")) {
+		std::cerr << "Usage: icp_index <model mesh> <output.icpidx> [--levels L]" << std::endl;
+		return 1;
+	}
+	size_t num_levels = argc == 5 ? std::stoul(argv[4]) : 1;
+
+	Model_Index::Point_Matrix verts;
+	Eigen::MatrixXi faces;
+	if (!read_mesh(argv[1], verts, faces) || verts.rows() == 0) {
+		std::cerr << "Could not load " << argv[1] << std::endl;
+		return 1;
+	}
+
+	Model_Index index(std::move(verts), faces, num_levels);
+	if (!index.save(argv[2])) {
+		return 1;
+	}
+
+	std::cout << "Wrote " << index.num_levels() << " level(s) to " << argv[2] << std::endl;
+	return 0;
+}
@@ -0,0 +1,137 @@
+//
+//  icp_kernel_check.cpp
+//  icp_project
+//
+//  Checks the AVX2 path of accumulate_pair_statistics() against its scalar
+//  loop, for every point storage, on random pairs far from the origin.
+//
+//  Usage: icp_kernel_check [--pairs N] [--seed S]
+//
+//  Exits with 1 if some sum differs by more than round-off, and with 77
+//  (skipped, to ctest) if the build or the CPU has no AVX2 path.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "Registration_Kernel.hpp"
+
+struct Check_Options {
+	size_t num_pairs = 1003;	// not a multiple of 4, so the tail is covered
+	unsigned seed = 1;
+};
+
+bool parse_options(int argc, char *argv[], Check_Options &options) {
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--pairs" && has_value) {
+			options.num_pairs = std::stoul(argv[++i]);
+		} else if (arg == "--seed" && has_value) {
+			options.seed = std::stoul(argv[++i]);
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Largest difference between the sums, against the largest sum */
+double relative_difference(const Pair_Statistics &a, const Pair_Statistics &b) {
+
+	double scale = std::max({std::abs(b.weight_sum), b.data_sum.cwiseAbs().maxCoeff(),
+		b.model_sum.cwiseAbs().maxCoeff(), b.cross_sum.cwiseAbs().maxCoeff(),
+		std::abs(b.data_sq_sum), std::abs(b.model_sq_sum), 1e-300});
+
+	double difference = std::max({std::abs(a.weight_sum - b.weight_sum),
+		(a.data_sum - b.data_sum).cwiseAbs().maxCoeff(),
+		(a.model_sum - b.model_sum).cwiseAbs().maxCoeff(),
+		(a.cross_sum - b.cross_sum).cwiseAbs().maxCoeff(),
+		std::abs(a.data_sq_sum - b.data_sq_sum), std::abs(a.model_sq_sum - b.model_sq_sum)});
+
+	return difference / scale;
+}
+
+/* Returns false if the two paths disagree on any of a few pair ranges */
+template <typename Scalar, int Layout>
+bool check_storage(const char *name, const Check_Options &options) {
+
+	typedef typename Point_Storage<Scalar, Layout>::Matrix Matrix;
+	std::mt19937 rng(options.seed);
+	std::uniform_real_distribution<double> unit(-1, 1);
+	std::uniform_real_distribution<double> weight(0, 1);
+
+	// Clouds of unit size, 1e3 away from the origin and from each other
+	const size_t data_rows = 500, model_rows = 700;
+	Matrix data_points, model_points;
+	resize_points(data_points, data_rows);
+	resize_points(model_points, model_rows);
+	for (size_t i=0; i<data_rows; i++) {
+		for (int d=0; d<3; d++) data_points(i, d) = 1e3 + unit(rng);
+	}
+	for (size_t i=0; i<model_rows; i++) {
+		for (int d=0; d<3; d++) model_points(i, d) = -1e3 + unit(rng);
+	}
+	Point_Cloud_Adaptor<Scalar, Layout> data_verts(data_points), model_verts(model_points);
+
+	Correspondence_Set pairs;
+	pairs.resize(options.num_pairs);
+	for (size_t k=0; k<pairs.size(); k++) {
+		pairs.data_index[k] = rng() % data_rows;
+		pairs.model_index[k] = rng() % model_rows;
+		pairs.distance[k] = 0;
+		pairs.weight[k] = weight(rng);
+	}
+
+	// Whole set, an unaligned start and end, and fewer pairs than a vector
+	size_t n = pairs.size();
+	size_t ranges[][2] = {{0, n}, {std::min<size_t>(3, n), n - std::min<size_t>(2, n)},
+		{0, std::min<size_t>(3, n)}};
+
+	bool passed = true;
+	for (size_t r=0; r<sizeof(ranges)/sizeof(ranges[0]); r++) {
+		Pair_Statistics vector_stats(Eigen::Vector3d::Constant(1e3), Eigen::Vector3d::Constant(-1e3));
+		Pair_Statistics scalar_stats = vector_stats;
+
+		set_pair_statistics_vectorized(true);
+		accumulate_pair_statistics(data_verts, model_verts, pairs, ranges[r][0], ranges[r][1], vector_stats);
+		set_pair_statistics_vectorized(false);
+		accumulate_pair_statistics(data_verts, model_verts, pairs, ranges[r][0], ranges[r][1], scalar_stats);
+
+		// FMA rounds differently, a wrong index would be off by far more
+		double difference = relative_difference(vector_stats, scalar_stats);
+		bool ok = difference <= 1e-12;
+		passed = passed && ok;
+		std::cerr << name << ", pairs [" << ranges[r][0] << ", " << ranges[r][1] << "): relative difference "
+		<< difference << (ok ? "" : ", FAILED") << std::endl;
+	}
+	return passed;
+}
+
+int main(int argc, char *argv[]) {
+
+	Check_Options options;
+	if (!parse_options(argc, argv, options)) {
+		std::cerr << "Usage: icp_kernel_check [--pairs N] [--seed S]" << std::endl;
+		return 2;
+	}
+
+	if (!pair_statistics_vectorized()) {
+		std::cerr << "No AVX2 path in this build or on this CPU, nothing to check" << std::endl;
+		return 77;
+	}
+
+	bool passed = true;
+	passed = check_storage<float, row_major_padded>("float, row_major_padded", options) && passed;
+	passed = check_storage<double, row_major_padded>("double, row_major_padded", options) && passed;
+	passed = check_storage<float, column_major>("float, column_major", options) && passed;
+	passed = check_storage<double, column_major>("double, column_major", options) && passed;
+
+	set_pair_statistics_vectorized(true);
+	return passed ? 0 : 1;
+}
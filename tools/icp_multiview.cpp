@@ -0,0 +1,113 @@
+//
+//  icp_multiview.cpp
+//  icp_project
+//
+//  Registers a whole set of roughly aligned scans into one frame.
+//
+//  Usage: icp_multiview <scan> <scan> ... [-o poses.txt] [-j workers]
+//                       [--levels L] [--objective point|plane]
+//                       [--min-overlap F] [--max-neighbors K]
+//
+//  Writes one line per scan: its path followed by the 3 x 4 matrix
+//  [R | t], row by row, that maps it into the frame of the first scan.
+//
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Mesh_Loader.hpp"
+#include "Multi_View.hpp"
+
+void print_usage() {
+	std::cerr << "Usage: icp_multiview <scan> <scan> ... [-o poses.txt] [-j workers]"
+	<< " [--levels L] [--objective point|plane] [--min-overlap F]"
+	<< " [--max-neighbors K]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+
+	std::vector<std::string> paths;
+	std::string output;
+	size_t num_workers = 0, num_levels = 1, max_neighbors = 6;
+	double min_overlap = 0.3;
+	ICP_Objective objective = point_to_point;
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-o" && has_value) {
+			output = argv[++i];
+		} else if (arg == "-j" && has_value) {
+			num_workers = std::stoul(argv[++i]);
+		} else if (arg == "--levels" && has_value) {
+			num_levels = std::stoul(argv[++i]);
+		} else if (arg == "--min-overlap" && has_value) {
+			min_overlap = std::stod(argv[++i]);
+		} else if (arg == "--max-neighbors" && has_value) {
+			max_neighbors = std::stoul(argv[++i]);
+		} else if (arg == "--objective" && has_value) {
+			std::string name = argv[++i];
+			if (name != "point" && name != "plane") {
+				print_usage();
+				return 1;
+			}
+			objective = name == "plane" ? point_to_plane : point_to_point;
+		} else if (arg[0] != '-') {
+			paths.push_back(arg);
+		} else {
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (paths.size() < 2) {
+		print_usage();
+		return 1;
+	}
+
+	std::vector<Eigen::MatrixXd> views(paths.size());
+	for (size_t k=0; k<paths.size(); k++) {
+		if (!read_points(paths[k], views[k]) || views[k].rows() == 0) {
+			std::cerr << "Could not load " << paths[k] << std::endl;
+			return 1;
+		}
+	}
+
+	Multi_View_Registration registration(std::move(views));
+	registration.num_workers = num_workers;
+	registration.num_levels = num_levels;
+	registration.objective = objective;
+	registration.min_overlap = min_overlap;
+	registration.max_neighbors = max_neighbors;
+
+	if (!registration.register_views()) {
+		std::cerr << "Some scans overlap no other scan and were left in place" << std::endl;
+	}
+
+	std::ofstream file;
+	if (!output.empty()) {
+		file.open(output);
+		if (!file) {
+			std::cerr << "Could not write " << output << std::endl;
+			return 1;
+		}
+	}
+	std::ostream &out = output.empty() ? std::cout : file;
+	out.precision(17);
+
+	for (size_t k=0; k<paths.size(); k++) {
+		out << paths[k];
+		for (int a=0; a<3; a++) {
+			for (int b=0; b<3; b++) {
+				out << " " << registration.rotations[k](a, b);
+			}
+			out << " " << registration.translations[k](a);
+		}
+		out << "\n";
+	}
+
+	return 0;
+}
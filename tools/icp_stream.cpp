@@ -0,0 +1,118 @@
+//
+//  icp_stream.cpp
+//  icp_project
+//
+//  Out-of-core registration for clouds that do not fit in memory.
+//
+//  Usage: icp_stream tile <model points> <tile directory> [--tile-points N]
+//         icp_stream register <data points> <tile directory>
+//                    [--chunk N] [--resident-tiles N] [--objective point|plane]
+//
+//  'tile' cuts the model into a directory of model index tiles, once.
+//  'register' streams the data through them and prints the pose. Both
+//  read their points a chunk at a time, from OBJ or PLY files alike.
+//
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "Streaming_Solver.hpp"
+#include "Tiled_Model_Index.hpp"
+
+struct Stream_Options {
+	std::string command;
+	std::string points;
+	std::string directory;
+	size_t tile_points = 1 << 20;
+	size_t chunk_size = 1 << 20;
+	size_t resident_tiles = 16;
+	ICP_Objective objective = point_to_point;
+};
+
+void print_usage() {
+	std::cerr << "Usage: icp_stream tile <model points> <tile directory> [--tile-points N]" << std::endl
+	<< "       icp_stream register <data points> <tile directory>"
+	<< " [--chunk N] [--resident-tiles N] [--objective point|plane]" << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Stream_Options &options) {
+
+	if (argc < 4) {
+		return false;
+	}
+	options.command = argv[1];
+	options.points = argv[2];
+	options.directory = argv[3];
+
+	for (int i=4; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--tile-points" && has_value) {
+			options.tile_points = std::stoul(argv[++i]);
+		} else if (arg == "--chunk" && has_value) {
+			options.chunk_size = std::stoul(argv[++i]);
+		} else if (arg == "--resident-tiles" && has_value) {
+			options.resident_tiles = std::stoul(argv[++i]);
+		} else if (arg == "--objective" && has_value) {
+			std::string objective = argv[++i];
+			if (objective == "point") {
+				options.objective = point_to_point;
+			} else if (objective == "plane") {
+				options.objective = point_to_plane;
+			} else {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+
+	return options.command == "tile" || options.command == "register";
+}
+
+int main(int argc, char *argv[]) {
+
+	Stream_Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (options.command == "tile") {
+		if (!Tiled_Model_Index::build(options.points, options.directory, options.tile_points, options.chunk_size)) {
+			return 1;
+		}
+		std::shared_ptr<Tiled_Model_Index> index = Tiled_Model_Index::open(options.directory);
+		if (!index) {
+			return 1;
+		}
+		std::cout << "Wrote " << index->num_points() << " points in " << index->num_tiles()
+		<< " tiles to " << options.directory << std::endl;
+	} else {
+		std::shared_ptr<Tiled_Model_Index> index = Tiled_Model_Index::open(options.directory,
+																		   options.resident_tiles);
+		if (!index) {
+			return 1;
+		}
+
+		Streaming_Solver solver(options.points, *index, options.chunk_size);
+		if (!solver.is_open()) {
+			return 1;
+		}
+		solver.objective = options.objective;
+
+		bool converged = solver.perform_icp();
+		std::cout << (converged ? "Converged" : "Did not converge") << " after "
+		<< solver.get_iterations() << " iterations, error " << solver.get_error() << std::endl
+		<< "Rotation:" << std::endl << solver.final_rotation << std::endl
+		<< "Translation: " << solver.final_translation.transpose() << std::endl;
+	}
+
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	std::cout << "Took " << seconds.count() << " s" << std::endl;
+	return 0;
+}
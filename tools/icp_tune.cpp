@@ -0,0 +1,287 @@
+//
+//  icp_tune.cpp
+//  icp_project
+//
+//  Sweep over ICP_Config settings on scan pairs from the mesh/ corpus.
+//
+//  Usage: icp_tune [-o results.csv] [--mesh-dir DIR] [--filter TEXT]
+//                  [--repeat N] [--threads T] [--objective point|plane|both]
+//                  [--leaf LIST] [--sampling LIST] [--sigma LIST]
+//                  [--cache LIST] [--slack F]
+//
+//  Every combination of the comma separated values of --leaf (points per
+//  kd-tree leaf), --sampling (sampling quotient), --sigma (rejection sigma)
+//  and --cache (neighbour cache motion limit) registers every pair. A
+//  setting passes on a pair if it converges wherever the defaults do, to
+//  an error at most 1 + --slack times theirs. The settings are listed
+//  fastest first by their total time over all pairs, and the fastest one
+//  that passes on every pair is named at the end.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ICP_Solver.hpp"
+#include "Mesh_Loader.hpp"
+#include "Scan_Pairs.hpp"
+
+#ifndef ICP_TUNE_MESH_DIR
+#define ICP_TUNE_MESH_DIR "mesh"
+#endif
+
+struct Tune_Case {
+	std::string name;
+	ICP_Objective objective = point_to_point;
+	Eigen::MatrixXd data_verts, model_verts;
+	Eigen::MatrixXi model_faces;
+
+	// Outcome with the default settings
+	bool converged = false;
+	double error = 0;
+};
+
+struct Tune_Options {
+	std::string output;
+	std::string mesh_dir = ICP_TUNE_MESH_DIR;
+	std::string filter;
+	size_t repeat = 1;
+	size_t num_threads = 0;
+	std::vector<ICP_Objective> objectives = {point_to_point, point_to_plane};
+	std::vector<double> leaf = {5, 10, 20};
+	std::vector<double> sampling = {1, 0.5};
+	std::vector<double> sigma = {1.5, 2};
+	std::vector<double> cache = {0.5};
+	double slack = 0.05;
+};
+
+struct Run_Result {
+	bool converged = false;
+	int iterations = 0;
+	double error = 0;
+	double ms = 0;
+};
+
+struct Setting_Result {
+	ICP_Config config;
+	double total_ms = 0;
+	int iterations = 0;
+	double worst_ratio = 0;		// largest error against the defaults'
+	size_t failed = 0;			// pairs it does not pass on
+};
+
+/* Registers 'tune_case' under 'config' --repeat times, keeping the fastest run */
+Run_Result run_case(const Tune_Case &tune_case, const ICP_Config &config, const Tune_Options &options) {
+
+	Run_Result result;
+	for (size_t r=0; r<std::max<size_t>(options.repeat, 1); r++) {
+		ICP_Solver solver(tune_case.data_verts, tune_case.model_verts, tune_case.model_faces);
+		solver.verbose = false;
+		solver.num_threads = options.num_threads;
+		solver.objective = tune_case.objective;
+		solver.config = config;
+
+		bool converged = solver.perform_icp();
+		double ms = solver.get_timings().total() * 1e-6;
+		if (r == 0 || ms < result.ms) {
+			result.converged = converged;
+			result.iterations = solver.get_iterations();
+			result.error = solver.get_error();
+			result.ms = ms;
+		}
+	}
+	return result;
+}
+
+bool parse_list(const std::string &text, std::vector<double> &values) {
+
+	values.clear();
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		try {
+			values.push_back(std::stod(item));
+		} catch (...) {
+			return false;
+		}
+	}
+	return !values.empty();
+}
+
+void print_usage() {
+	std::cerr << "Usage: icp_tune [-o results.csv] [--mesh-dir DIR] [--filter TEXT]"
+	<< " [--repeat N] [--threads T] [--objective point|plane|both]"
+	<< " [--leaf LIST] [--sampling LIST] [--sigma LIST] [--cache LIST]"
+	<< " [--slack F]" << std::endl;
+}
+
+bool parse_options(int argc, char *argv[], Tune_Options &options) {
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-o" && has_value) {
+			options.output = argv[++i];
+		} else if (arg == "--mesh-dir" && has_value) {
+			options.mesh_dir = argv[++i];
+		} else if (arg == "--filter" && has_value) {
+			options.filter = argv[++i];
+		} else if (arg == "--repeat" && has_value) {
+			options.repeat = std::stoul(argv[++i]);
+		} else if (arg == "--threads" && has_value) {
+			options.num_threads = std::stoul(argv[++i]);
+		} else if (arg == "--slack" && has_value) {
+			options.slack = std::stod(argv[++i]);
+		} else if (arg == "--objective" && has_value) {
+			std::string name = argv[++i];
+			if (name == "point") options.objectives = {point_to_point};
+			else if (name == "plane") options.objectives = {point_to_plane};
+			else if (name == "both") options.objectives = {point_to_point, point_to_plane};
+			else return false;
+		} else if (arg == "--leaf" && has_value) {
+			if (!parse_list(argv[++i], options.leaf)) return false;
+		} else if (arg == "--sampling" && has_value) {
+			if (!parse_list(argv[++i], options.sampling)) return false;
+		} else if (arg == "--sigma" && has_value) {
+			if (!parse_list(argv[++i], options.sigma)) return false;
+		} else if (arg == "--cache" && has_value) {
+			if (!parse_list(argv[++i], options.cache)) return false;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* The scan pairs of icp_bench, under every objective asked for */
+std::vector<Tune_Case> load_cases(const Tune_Options &options) {
+
+	std::vector<Tune_Case> cases;
+	for (size_t i=0; i<num_scan_pairs; i++) {
+		const Scan_Pair &scan = scan_pairs[i];
+		if (!options.filter.empty() && std::string(scan.name).find(options.filter) == std::string::npos) {
+			continue;
+		}
+
+		Tune_Case tune_case;
+		std::string data_path = options.mesh_dir + "/" + scan.data_file;
+		std::string model_path = options.mesh_dir + "/" + scan.model_file;
+		if (!read_points(data_path, tune_case.data_verts) ||
+			!read_mesh(model_path, tune_case.model_verts, tune_case.model_faces) ||
+			tune_case.data_verts.rows() == 0 || tune_case.model_verts.rows() == 0) {
+			std::cerr << scan.name << ": could not load" << std::endl;
+			continue;
+		}
+
+		for (size_t o=0; o<options.objectives.size(); o++) {
+			tune_case.objective = options.objectives[o];
+			tune_case.name = std::string(scan.name)
+			+ (tune_case.objective == point_to_plane ? " (plane)" : " (point)");
+			cases.push_back(tune_case);
+		}
+	}
+	return cases;
+}
+
+void write_csv(std::ostream &out, const std::vector<Setting_Result> &settings) {
+
+	out << "max_leaf,sampling_quotient,rejection_sigma,cache_motion_limit,"
+	<< "total_ms,iterations,worst_error_ratio,failed\n";
+	out.precision(9);
+
+	for (size_t s=0; s<settings.size(); s++) {
+		const Setting_Result &r = settings[s];
+		out << r.config.max_leaf << "," << r.config.sampling_quotient << ","
+		<< r.config.rejection_sigma << "," << r.config.cache_motion_limit << ","
+		<< r.total_ms << "," << r.iterations << "," << r.worst_ratio << "," << r.failed << "\n";
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	Tune_Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 1;
+	}
+
+	std::vector<Tune_Case> cases = load_cases(options);
+	if (cases.empty()) {
+		std::cerr << "No pairs to tune on" << std::endl;
+		return 1;
+	}
+
+	// What the settings are held against
+	const ICP_Config defaults;
+	for (size_t c=0; c<cases.size(); c++) {
+		Run_Result result = run_case(cases[c], defaults, options);
+		cases[c].converged = result.converged;
+		cases[c].error = result.error;
+		std::cerr << cases[c].name << ": " << result.ms << " ms, " << result.iterations
+		<< " iterations, error " << result.error << " with the defaults" << std::endl;
+	}
+
+	std::vector<Setting_Result> settings;
+	for (size_t l=0; l<options.leaf.size(); l++)
+	for (size_t q=0; q<options.sampling.size(); q++)
+	for (size_t s=0; s<options.sigma.size(); s++)
+	for (size_t m=0; m<options.cache.size(); m++) {
+		Setting_Result setting;
+		setting.config.max_leaf = std::max<size_t>(1, options.leaf[l]);
+		setting.config.sampling_quotient = options.sampling[q];
+		setting.config.rejection_sigma = options.sigma[s];
+		setting.config.cache_motion_limit = options.cache[m];
+
+		for (size_t c=0; c<cases.size(); c++) {
+			Run_Result result = run_case(cases[c], setting.config, options);
+			setting.total_ms += result.ms;
+			setting.iterations += result.iterations;
+
+			double ratio = cases[c].error > 0 ? result.error / cases[c].error : (result.error > 0 ? MAXFLOAT : 1);
+			setting.worst_ratio = std::max(setting.worst_ratio, ratio);
+			if ((cases[c].converged && !result.converged) || !(ratio <= 1 + options.slack)) {
+				setting.failed++;
+			}
+		}
+
+		std::cerr << "leaf " << setting.config.max_leaf << ", sampling " << setting.config.sampling_quotient
+		<< ", sigma " << setting.config.rejection_sigma << ", cache " << setting.config.cache_motion_limit
+		<< ": " << setting.total_ms << " ms, worst error ratio " << setting.worst_ratio
+		<< ", failed on " << setting.failed << " of " << cases.size() << std::endl;
+		settings.push_back(setting);
+	}
+
+	std::stable_sort(settings.begin(), settings.end(), [](const Setting_Result &a, const Setting_Result &b) {
+		return a.total_ms < b.total_ms;
+	});
+
+	std::ofstream file;
+	if (!options.output.empty()) {
+		file.open(options.output);
+		if (!file) {
+			std::cerr << "Could not write " << options.output << std::endl;
+			return 1;
+		}
+	}
+	write_csv(options.output.empty() ? std::cout : file, settings);
+
+	for (size_t s=0; s<settings.size(); s++) {
+		if (settings[s].failed == 0) {
+			const ICP_Config &best = settings[s].config;
+			std::cerr << "Fastest passing: max_leaf " << best.max_leaf << ", sampling_quotient "
+			<< best.sampling_quotient << ", rejection_sigma " << best.rejection_sigma
+			<< ", cache_motion_limit " << best.cache_motion_limit
+			<< " (" << settings[s].total_ms << " ms)" << std::endl;
+			return 0;
+		}
+	}
+
+	std::cerr << "No setting passed on every pair" << std::endl;
+	return 0;
+}